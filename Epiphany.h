@@ -31,7 +31,19 @@ FunctionPass *createEpiphanyISelDAG(EpiphanyTargetMachine &TM,
 
 FunctionPass *createEpiphanyCondMovPass(EpiphanyTargetMachine &TM);
 
+FunctionPass *createEpiphanyConfigUpdateSplitPass(EpiphanyTargetMachine &TM);
+
 FunctionPass *createEpiphanyLSOptPass();
+FunctionPass *createEpiphanyPostRALSOptPass();
+
+FunctionPass *createEpiphanyHardwareLoopsPass();
+FunctionPass *createEpiphanyHardwareLoopFixupPass();
+
+FunctionPass *createEpiphanyPostIncCombinePass();
+
+FunctionPass *createEpiphanyCompress16Pass();
+
+FunctionPass *createEpiphanyBranchRelaxationPass();
 
 void LowerEpiphanyMachineInstrToMCInst(const MachineInstr *MI, MCInst &OutMI,
                                       EpiphanyAsmPrinter &AP);
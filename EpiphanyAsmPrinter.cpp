@@ -279,7 +279,32 @@ void EpiphanyAsmPrinter::PrintDebugValueComment(const MachineInstr *MI,
 
 #include "EpiphanyGenMCPseudoLowering.inc"
 
+MCSymbol *
+EpiphanyAsmPrinter::GetHWLoopEndSymbol(const MachineBasicBlock *MBB) const {
+  return OutContext.getOrCreateSymbol(Twine(MAI->getPrivateGlobalPrefix()) +
+                                      "HWLE" + Twine(getFunctionNumber()) +
+                                      "_" + Twine(MBB->getNumber()));
+}
+
+/// Is MI the last real instruction before a HWLOOP_END, i.e. the instruction
+/// LE has to point at?
+static bool isLastInHWLoop(const MachineInstr *MI) {
+  if (MI->isDebugValue())
+    return false;
+
+  MachineBasicBlock::const_iterator I = MI, E = MI->getParent()->end();
+  for (++I; I != E; ++I) {
+    if (I->isDebugValue() || I->isKill() || I->isImplicitDef())
+      continue;
+    return I->getOpcode() == Epiphany::HWLOOP_END;
+  }
+  return false;
+}
+
 void EpiphanyAsmPrinter::EmitInstruction(const MachineInstr *MI) {
+  if (isLastInHWLoop(MI))
+    OutStreamer->EmitLabel(GetHWLoopEndSymbol(MI->getParent()));
+
   // Do any auto-generated pseudo lowerings.
   if (emitPseudoExpansionLowering(*OutStreamer, MI))
     return;
@@ -294,6 +319,9 @@ void EpiphanyAsmPrinter::EmitInstruction(const MachineInstr *MI) {
     }
     return;
   }
+  case Epiphany::HWLOOP_END:
+    // The loop hardware does the branch back, nothing to emit.
+    return;
   }
 
   MCInst TmpInst;
@@ -45,6 +45,10 @@ class LLVM_LIBRARY_VISIBILITY EpiphanyAsmPrinter : public AsmPrinter {
   MCOperand lowerSymbolOperand(const MachineOperand &MO,
                                const MCSymbol *Sym) const;
 
+  /// GetHWLoopEndSymbol - Label on the last instruction of the hardware loop
+  /// whose body is MBB, i.e. the value loaded into LE.
+  MCSymbol *GetHWLoopEndSymbol(const MachineBasicBlock *MBB) const;
+
   void EmitInstruction(const MachineInstr *MI) override;
   void EmitEndOfAsmFile(Module &M);
 
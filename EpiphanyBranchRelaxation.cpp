@@ -0,0 +1,228 @@
+//===-- EpiphanyBranchRelaxation.cpp - Pick short or long branches --------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Conditional and unconditional branches come in a 16-bit form with an 8-bit
+// halfword displacement (-256..+254 bytes) and a 32-bit form with a 24-bit
+// one. Instruction selection always produces the long form. This pass starts
+// by making every branch short, then lays out the function using
+// getInstSizeInBytes and grows the branches whose target is out of reach.
+// Growing a branch can push others out of range, so it iterates until
+// nothing changes. Branches only ever get longer, so this terminates.
+//
+// The 24-bit form reaches +-16MB, which is more than any Epiphany memory
+// bank, so long branches are never out of range.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "epiphany-branch-relax"
+#include "Epiphany.h"
+#include "EpiphanyInstrInfo.h"
+#include "EpiphanySubtarget.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumShort, "Number of branches using the 16-bit encoding");
+STATISTIC(NumRelaxed, "Number of branches relaxed to the 32-bit encoding");
+
+namespace {
+
+class EpiphanyBranchRelaxation : public MachineFunctionPass {
+  /// Layout of one basic block. Offset is where the block starts relative to
+  /// the function, Size the sum of its instruction sizes.
+  struct BasicBlockInfo {
+    unsigned Offset;
+    unsigned Size;
+
+    BasicBlockInfo() : Offset(0), Size(0) {}
+
+    /// The offset the next block would start at before alignment.
+    unsigned postOffset() const { return Offset + Size; }
+  };
+
+  SmallVector<BasicBlockInfo, 16> BlockInfo;
+  MachineFunction *MF;
+  const EpiphanyInstrInfo *TII;
+
+public:
+  static char ID;
+  EpiphanyBranchRelaxation() : MachineFunctionPass(ID) {}
+
+  const char *getPassName() const override {
+    return "Epiphany branch relaxation";
+  }
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  bool shortenBranches();
+  void computeBlockSize(const MachineBasicBlock &MBB);
+  void adjustBlockOffsets(const MachineBasicBlock &Start);
+  unsigned getInstrOffset(const MachineInstr *MI) const;
+  bool isBlockInRange(const MachineInstr *MI,
+                      const MachineBasicBlock *DestBB) const;
+  bool relaxBranches();
+};
+
+char EpiphanyBranchRelaxation::ID = 0;
+
+} // end anonymous namespace
+
+/// Map a branch to its 16-bit form, or return 0 if it has none.
+static unsigned getShortBranchOpcode(unsigned Opc) {
+  switch (Opc) {
+  default:              return 0;
+  case Epiphany::Bcc:   return Epiphany::Bcc16;
+  case Epiphany::Bcc_f: return Epiphany::Bcc16_f;
+  case Epiphany::Bimm:  return Epiphany::Bimm16;
+  }
+}
+
+/// Map a 16-bit branch back to its 32-bit form, or return 0 if it isn't one.
+static unsigned getLongBranchOpcode(unsigned Opc) {
+  switch (Opc) {
+  default:                return 0;
+  case Epiphany::Bcc16:   return Epiphany::Bcc;
+  case Epiphany::Bcc16_f: return Epiphany::Bcc_f;
+  case Epiphany::Bimm16:  return Epiphany::Bimm;
+  }
+}
+
+static MachineBasicBlock *getDestBlock(const MachineInstr *MI) {
+  // Conditional branches have the condition first.
+  return MI->getOperand(MI->getNumExplicitOperands() - 1).getMBB();
+}
+
+/// Switch every branch to the short form. Hardware loop bodies must stay made
+/// of 32-bit instructions, so their blocks are left alone.
+bool EpiphanyBranchRelaxation::shortenBranches() {
+  bool Changed = false;
+  for (MachineFunction::iterator MBB = MF->begin(), E = MF->end(); MBB != E;
+       ++MBB) {
+    MachineBasicBlock::iterator Term = MBB->getFirstTerminator();
+    if (Term != MBB->end() && Term->getOpcode() == Epiphany::HWLOOP_END)
+      continue;
+
+    for (MachineBasicBlock::iterator MI = Term, ME = MBB->end(); MI != ME;
+         ++MI) {
+      if (unsigned NewOpc = getShortBranchOpcode(MI->getOpcode())) {
+        MI->setDesc(TII->get(NewOpc));
+        Changed = true;
+      }
+    }
+  }
+  return Changed;
+}
+
+void EpiphanyBranchRelaxation::computeBlockSize(const MachineBasicBlock &MBB) {
+  unsigned Size = 0;
+  for (MachineBasicBlock::const_iterator I = MBB.begin(), E = MBB.end();
+       I != E; ++I)
+    Size += TII->getInstSizeInBytes(*I);
+  BlockInfo[MBB.getNumber()].Size = Size;
+}
+
+/// Recompute the offsets of Start and every block after it.
+void EpiphanyBranchRelaxation::adjustBlockOffsets(
+    const MachineBasicBlock &Start) {
+  unsigned PrevNum = Start.getNumber();
+  for (MachineFunction::const_iterator MBB = ++Start.getIterator(),
+         E = MF->end(); MBB != E; ++MBB) {
+    unsigned Num = MBB->getNumber();
+    unsigned Align = 1u << MBB->getAlignment();
+    BlockInfo[Num].Offset =
+      RoundUpToAlignment(BlockInfo[PrevNum].postOffset(), Align);
+    PrevNum = Num;
+  }
+}
+
+unsigned EpiphanyBranchRelaxation::getInstrOffset(const MachineInstr *MI) const {
+  const MachineBasicBlock *MBB = MI->getParent();
+  unsigned Offset = BlockInfo[MBB->getNumber()].Offset;
+  for (MachineBasicBlock::const_iterator I = MBB->begin(); &*I != MI; ++I)
+    Offset += TII->getInstSizeInBytes(*I);
+  return Offset;
+}
+
+/// Can the short form of MI reach DestBB?
+bool EpiphanyBranchRelaxation::isBlockInRange(
+    const MachineInstr *MI, const MachineBasicBlock *DestBB) const {
+  int64_t BrOffset = getInstrOffset(MI);
+  int64_t DestOffset = BlockInfo[DestBB->getNumber()].Offset;
+  return isInt<9>(DestOffset - BrOffset);
+}
+
+/// Grow every short branch that can't reach its target. Returns true if any
+/// block changed size.
+bool EpiphanyBranchRelaxation::relaxBranches() {
+  bool Changed = false;
+  for (MachineFunction::iterator MBB = MF->begin(), E = MF->end(); MBB != E;
+       ++MBB) {
+    for (MachineBasicBlock::iterator MI = MBB->getFirstTerminator(),
+           ME = MBB->end(); MI != ME; ++MI) {
+      unsigned LongOpc = getLongBranchOpcode(MI->getOpcode());
+      if (!LongOpc || isBlockInRange(MI, getDestBlock(MI)))
+        continue;
+
+      DEBUG(dbgs() << "  Relaxing " << *MI);
+      MI->setDesc(TII->get(LongOpc));
+      computeBlockSize(*MBB);
+      adjustBlockOffsets(*MBB);
+      ++NumRelaxed;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+bool EpiphanyBranchRelaxation::runOnMachineFunction(MachineFunction &mf) {
+  MF = &mf;
+  TII = MF->getSubtarget<EpiphanySubtarget>().getInstrInfo();
+
+  DEBUG(dbgs() << "***** EpiphanyBranchRelaxation *****\n");
+
+  if (!shortenBranches())
+    return false;
+
+  // Lay out the function with every branch short.
+  MF->RenumberBlocks();
+  BlockInfo.clear();
+  BlockInfo.resize(MF->getNumBlockIDs());
+  for (MachineFunction::iterator MBB = MF->begin(), E = MF->end(); MBB != E;
+       ++MBB)
+    computeBlockSize(*MBB);
+  adjustBlockOffsets(*MF->begin());
+
+  while (relaxBranches())
+    ;
+
+  for (MachineFunction::iterator MBB = MF->begin(), E = MF->end(); MBB != E;
+       ++MBB)
+    for (MachineBasicBlock::iterator MI = MBB->getFirstTerminator(),
+           ME = MBB->end(); MI != ME; ++MI)
+      if (getLongBranchOpcode(MI->getOpcode()))
+        ++NumShort;
+
+  BlockInfo.clear();
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+//                         Public Constructor Functions
+//===----------------------------------------------------------------------===//
+
+FunctionPass *llvm::createEpiphanyBranchRelaxationPass() {
+  return new EpiphanyBranchRelaxation();
+}
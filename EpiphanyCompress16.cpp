@@ -0,0 +1,125 @@
+//===-- EpiphanyCompress16.cpp - Use 16-bit instruction encodings ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Most Epiphany instructions have a 16-bit encoding when every register operand
+// is r0-r7 and any immediate is short. Instruction selection only knows about
+// the 32-bit forms; once registers are assigned this pass switches whatever it
+// can to the short form. The two forms have the same operands, flags and
+// timing, so this is just a change of opcode.
+//
+// Hardware loop bodies are left alone: the loop hardware requires them to be
+// made of 32-bit instructions.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "epiphany-compress16"
+#include "Epiphany.h"
+#include "EpiphanyInstrInfo.h"
+#include "EpiphanySubtarget.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumCompressed, "Number of instructions changed to 16-bit encodings");
+
+namespace {
+
+class EpiphanyCompress16 : public MachineFunctionPass {
+  const EpiphanyInstrInfo *TII;
+
+public:
+  static char ID;
+  EpiphanyCompress16() : MachineFunctionPass(ID) {}
+
+  const char *getPassName() const override {
+    return "Epiphany 16-bit instruction compression";
+  }
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  bool canCompress(const MachineInstr &MI) const;
+};
+
+char EpiphanyCompress16::ID = 0;
+
+} // end anonymous namespace
+
+/// Do MI's operands fit the short encoding?
+bool EpiphanyCompress16::canCompress(const MachineInstr &MI) const {
+  // Every explicit register operand has to be r0-r7. Implicit ones (flags,
+  // call clobbers) are the same for both forms.
+  for (unsigned i = 0, e = MI.getDesc().getNumOperands(); i != e; ++i) {
+    const MachineOperand &MO = MI.getOperand(i);
+    if (MO.isReg() && !Epiphany::GPR16RegClass.contains(MO.getReg()))
+      return false;
+  }
+
+  switch (MI.getOpcode()) {
+  default:
+    return true;
+  case Epiphany::ADDri:
+  case Epiphany::SUBri:
+  case Epiphany::SUBri_cmp:
+    return MI.getOperand(2).isImm() && isInt<3>(MI.getOperand(2).getImm());
+  case Epiphany::MOVri:
+  case Epiphany::MOVri_nopat:
+    // Symbol halves (MO_LO16) are not immediates and always need 32 bits.
+    return MI.getOperand(1).isImm() && isUInt<8>(MI.getOperand(1).getImm());
+  case Epiphany::LS8_LDR:
+  case Epiphany::LS16_LDR:
+  case Epiphany::LS32_LDR:
+  case Epiphany::LSFP32_LDR:
+  case Epiphany::LS8_STR:
+  case Epiphany::LS16_STR:
+  case Epiphany::LS32_STR:
+  case Epiphany::LSFP32_STR:
+    // The offset is already scaled by the access size.
+    return MI.getOperand(2).isImm() && isUInt<3>(MI.getOperand(2).getImm());
+  }
+}
+
+bool EpiphanyCompress16::runOnMachineFunction(MachineFunction &MF) {
+  TII = MF.getSubtarget<EpiphanySubtarget>().getInstrInfo();
+
+  bool Changed = false;
+  for (MachineFunction::iterator MBB = MF.begin(), E = MF.end(); MBB != E;
+       ++MBB) {
+    MachineBasicBlock::iterator Term = MBB->getFirstTerminator();
+    if (Term != MBB->end() && Term->getOpcode() == Epiphany::HWLOOP_END)
+      continue;
+
+    for (MachineBasicBlock::iterator MI = MBB->begin(), ME = MBB->end();
+         MI != ME; ++MI) {
+      unsigned NewOpc = TII->getCompressedOpcode(MI->getOpcode());
+      if (!NewOpc || !canCompress(*MI))
+        continue;
+
+      DEBUG(dbgs() << "Compressing " << *MI);
+      MI->setDesc(TII->get(NewOpc));
+      ++NumCompressed;
+      Changed = true;
+    }
+  }
+
+  return Changed;
+}
+
+//===----------------------------------------------------------------------===//
+//                         Public Constructor Functions
+//===----------------------------------------------------------------------===//
+
+FunctionPass *llvm::createEpiphanyCompress16Pass() {
+  return new EpiphanyCompress16();
+}
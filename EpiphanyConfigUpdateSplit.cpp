@@ -0,0 +1,91 @@
+//===-- EpiphanyConfigUpdateSplit.cpp - Isolate CONFIG updates ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass gives every llvm.epiphany.config.update call a basic block of its
+// own. CONFIG holds the FPU rounding and arithmetic modes, but floating-point
+// nodes have no chain, so within one selection DAG the scheduler is free to
+// put them on either side of the update. Blocks are selected separately and
+// in order, so after the split the code written before the update is emitted
+// before it and the code written after it follows. From there the implicit
+// CONFIG use on every floating-point instruction keeps machine passes from
+// undoing that.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "epiphany-config-split"
+#include "Epiphany.h"
+#include "EpiphanyIntrinsicInfo.h"
+#include "EpiphanyTargetMachine.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Pass.h"
+
+using namespace llvm;
+
+STATISTIC(NumSplit, "Number of blocks split around CONFIG updates");
+
+namespace {
+
+class EpiphanyConfigUpdateSplit : public FunctionPass {
+  EpiphanyTargetMachine &TM;
+
+public:
+  static char ID;
+  EpiphanyConfigUpdateSplit(EpiphanyTargetMachine &TM)
+    : FunctionPass(ID), TM(TM) {}
+
+  const char *getPassName() const override {
+    return "Epiphany CONFIG update block splitting";
+  }
+
+  bool runOnFunction(Function &F) override;
+};
+
+char EpiphanyConfigUpdateSplit::ID = 0;
+
+} // end anonymous namespace
+
+bool EpiphanyConfigUpdateSplit::runOnFunction(Function &F) {
+  const EpiphanyIntrinsicInfo *II = TM.getIntrinsicInfo();
+
+  SmallVector<CallInst *, 4> Updates;
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB)
+      if (CallInst *CI = dyn_cast<CallInst>(&I))
+        if (Function *Callee = CI->getCalledFunction())
+          if (II->getIntrinsicID(Callee) ==
+              EpiphanyIntrinsic::epiphany_config_update)
+            Updates.push_back(CI);
+
+  for (CallInst *CI : Updates) {
+    BasicBlock *BB = CI->getParent();
+    if (CI != BB->getFirstNonPHI()) {
+      BB = BB->splitBasicBlock(CI, BB->getName() + ".config");
+      ++NumSplit;
+    }
+    Instruction *Next = CI->getNextNode();
+    if (!isa<TerminatorInst>(Next)) {
+      BB->splitBasicBlock(Next, BB->getName() + ".cont");
+      ++NumSplit;
+    }
+  }
+
+  return !Updates.empty();
+}
+
+//===----------------------------------------------------------------------===//
+//                         Public Constructor Functions
+//===----------------------------------------------------------------------===//
+
+FunctionPass *llvm::createEpiphanyConfigUpdateSplitPass(
+    EpiphanyTargetMachine &TM) {
+  return new EpiphanyConfigUpdateSplit(TM);
+}
@@ -15,6 +15,7 @@
 #include "EpiphanyFrameLowering.h"
 #include "EpiphanyMachineFunctionInfo.h"
 #include "EpiphanyInstrInfo.h"
+#include "llvm/CodeGen/LivePhysRegs.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
@@ -44,6 +45,13 @@ void EpiphanyFrameLowering::splitSPAdjustments(uint64_t Total,
   }
 }
 
+/// SP adjustments too big for an immediate are built up in a temporary. Each
+/// one gets its own virtual register, which PEI hands to the register
+/// scavenger once the frame is final.
+static unsigned createScratchReg(MachineFunction &MF) {
+  return MF.getRegInfo().createVirtualRegister(&Epiphany::GPR32RegClass);
+}
+
 void EpiphanyFrameLowering::emitPrologue(MachineFunction &MF, MachineBasicBlock &MBB) const {
   EpiphanyMachineFunctionInfo *FuncInfo =
     MF.getInfo<EpiphanyMachineFunctionInfo>();
@@ -86,7 +94,7 @@ void EpiphanyFrameLowering::emitPrologue(MachineFunction &MF, MachineBasicBlock
   // have a different view of things.
   FuncInfo->setInitialStackAdjust(NumInitialBytes);
 
-  EPIPHemitSPUpdate(MBB, MBBI, DL, TII, Epiphany::R63, -NumInitialBytes,
+  EPIPHemitSPUpdate(MBB, MBBI, DL, TII, createScratchReg(MF), -NumInitialBytes,
                MachineInstr::FrameSetup);
 
   if (NeedsFrameMoves && NumInitialBytes) {
@@ -146,7 +154,7 @@ void EpiphanyFrameLowering::emitPrologue(MachineFunction &MF, MachineBasicBlock
 
   assert(!FPNeedsSetting && "Frame pointer couldn't be set");
 
-  EPIPHemitSPUpdate(MBB, MBBI, DL, TII, Epiphany::R63, -NumResidualBytes,
+  EPIPHemitSPUpdate(MBB, MBBI, DL, TII, createScratchReg(MF), -NumResidualBytes,
                MachineInstr::FrameSetup);
 
   // Now we emit the rest of the frame setup information, if necessary: we've
@@ -182,7 +190,7 @@ void EpiphanyFrameLowering::emitPrologue(MachineFunction &MF, MachineBasicBlock
 
     for (std::vector<CalleeSavedInfo>::const_iterator I = CSI.begin(),
            E = CSI.end(); I != E; ++I) {
-      unsigned Offset = MFI->getObjectOffset(I->getFrameIdx());
+      int64_t Offset = MFI->getObjectOffset(I->getFrameIdx());
       unsigned Reg = MRI.getDwarfRegNum(I->getReg(), true);
       MMI.addFrameInst(MCCFIInstruction::createOffset(CSLabel, Reg, Offset));
     }
@@ -195,11 +203,12 @@ EpiphanyFrameLowering::emitEpilogue(MachineFunction &MF,
   EpiphanyMachineFunctionInfo *FuncInfo =
     MF.getInfo<EpiphanyMachineFunctionInfo>();
 
-  MachineBasicBlock::iterator MBBI = MBB.getLastNonDebugInstr();
-  DebugLoc DL = MBBI->getDebugLoc();
+  // With shrink-wrapping this needn't be a return block, so the epilogue goes
+  // in front of whatever terminators there are (possibly none).
+  MachineBasicBlock::iterator MBBI = MBB.getFirstTerminator();
+  DebugLoc DL = MBBI != MBB.end() ? MBBI->getDebugLoc() : DebugLoc();
   const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
   MachineFrameInfo &MFI = *MF.getFrameInfo();
-  //unsigned RetOpcode = MBBI->getOpcode();
 
   // Initial and residual are named for consitency with the prologue. Note that
   // in the epilogue, the residual adjustment is executed first.
@@ -214,28 +223,22 @@ EpiphanyFrameLowering::emitEpilogue(MachineFunction &MF,
 
   // We may need to address callee-saved registers differently, so find out the
   // bound on the frame indices.
-  const std::vector<CalleeSavedInfo> &CSI = MFI.getCalleeSavedInfo();
-  int MinCSFI = 0;
-  int MaxCSFI = -1;
-
-  if (CSI.size()) {
-    MinCSFI = CSI[0].getFrameIdx();
-    MaxCSFI = CSI[CSI.size() - 1].getFrameIdx();
-  }
+  int MinCSFI, MaxCSFI;
+  getCalleeSavedFrameIndexRange(MFI, MinCSFI, MaxCSFI);
 
   // The "residual" stack update comes first from this direction and guarantees
   // that SP is NumInitialBytes below its value on function entry, either by a
   // direct update or restoring it from the frame pointer.
   if (NumInitialBytes + ArgumentPopSize != 0) {
-    EPIPHemitSPUpdate(MBB, MBBI, DL, TII, Epiphany::R63,
+    EPIPHemitSPUpdate(MBB, MBBI, DL, TII, createScratchReg(MF),
                  NumInitialBytes + ArgumentPopSize);
     --MBBI;
   }
 
 
   // MBBI now points to the instruction just past the last callee-saved
-  // restoration (either RET/B if NumInitialBytes == 0, or the "ADD sp, sp"
-  // otherwise).
+  // restoration (either the first terminator if NumInitialBytes == 0, or the
+  // "ADD sp, sp" otherwise).
 
   // Now we need to find out where to put the bulk of the stack adjustment
   MachineBasicBlock::iterator FirstEpilogue = MBBI;
@@ -265,13 +268,36 @@ EpiphanyFrameLowering::emitEpilogue(MachineFunction &MF,
     int64_t StaticFrameBase;
     StaticFrameBase = -(NumInitialBytes + FuncInfo->getFramePointerOffset());
     EPIPHemitRegUpdate(MBB, FirstEpilogue, DL, TII,
-                  Epiphany::SP, Epiphany::R11, Epiphany::NoRegister,
+                  Epiphany::SP, Epiphany::R11, createScratchReg(MF),
                   StaticFrameBase);
   } else {
-    EPIPHemitSPUpdate(MBB, FirstEpilogue, DL,TII, Epiphany::R63, NumResidualBytes);
+    EPIPHemitSPUpdate(MBB, FirstEpilogue, DL, TII, createScratchReg(MF),
+                      NumResidualBytes);
   }
 }
 
+bool
+EpiphanyFrameLowering::enableShrinkWrapping(const MachineFunction &MF) const {
+  return true;
+}
+
+bool
+EpiphanyFrameLowering::canUseAsEpilogue(const MachineBasicBlock &MBB) const {
+  const MachineFunction &MF = *MBB.getParent();
+
+  // The epilogue is inserted in front of the terminators, so find out what is
+  // live across that point.
+  LivePhysRegs LiveRegs(MF.getSubtarget().getRegisterInfo());
+  LiveRegs.addLiveOuts(&MBB);
+  for (MachineBasicBlock::const_iterator I = MBB.end(),
+         Term = MBB.getFirstTerminator(); I != Term;)
+    LiveRegs.stepBackward(*--I);
+
+  // The SP adjustment is an ADD, which would destroy the flags a conditional
+  // branch is about to test. Any temporary it needs comes from the scavenger.
+  return !LiveRegs.contains(Epiphany::NZCV);
+}
+
 int64_t
 EpiphanyFrameLowering::resolveFrameIndexReference(MachineFunction &MF,
                                                  int FrameIndex,
@@ -307,46 +333,45 @@ EpiphanyFrameLowering::resolveFrameIndexReference(MachineFunction &MF,
 }
 
 void
-EpiphanyFrameLowering::processFunctionBeforeCalleeSavedScan(MachineFunction &MF,
-                                                       RegScavenger *RS) const {
+EpiphanyFrameLowering::determineCalleeSaves(MachineFunction &MF,
+                                            BitVector &SavedRegs,
+                                            RegScavenger *RS) const {
+  TargetFrameLowering::determineCalleeSaves(MF, SavedRegs, RS);
+
   const EpiphanyRegisterInfo *RegInfo = static_cast<const EpiphanyRegisterInfo *>(MF.getSubtarget().getRegisterInfo());
   MachineFrameInfo *MFI = MF.getFrameInfo();
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
   const EpiphanyInstrInfo &TII = *static_cast<const EpiphanyInstrInfo *>(MF.getSubtarget().getInstrInfo());
 
-  if (hasFP(MF)) {
-    // TODO: Change this because setPhysRegUsed was removed.
-    //  See rev 242173 for the necessary restructuring
-    //MF.getRegInfo().setPhysRegUsed(Epiphany::R11);
-    //MF.getRegInfo().setPhysRegUsed(Epiphany::LR);
-  }
-
-  // If addressing of local variables is going to be more complicated than
-  // shoving a base register and an offset into the instruction then we may well
-  // need to scavenge registers. We should either specifically add an
-  // callee-save register for this purpose or allocate an extra spill slot.
-
+  // Large SP adjustments and frame offsets are built up in temporaries that
+  // the scavenger finds after the frame is laid out. We should either
+  // specifically save a callee-saved register for it or allocate an extra
+  // spill slot.
   bool BigStack =
-    (RS && MFI->estimateStackSize(MF) >= TII.estimateRSStackLimit(MF))
+    MFI->estimateStackSize(MF) >= TII.estimateRSStackLimit(MF)
     || MFI->hasVarSizedObjects() // Access will be from R11: messes things up
     || (MFI->adjustsStack() && !hasReservedCallFrame(MF));
 
-  if (!BigStack)
+  if (!BigStack || !RS)
     return;
 
   // We certainly need some slack space for the scavenger, preferably an extra
   // register.
-  const uint16_t *CSRegs = RegInfo->getCalleeSavedRegs();
+  const uint16_t *CSRegs = RegInfo->getCalleeSavedRegs(&MF);
   uint16_t ExtraReg = Epiphany::NoRegister;
 
   for (unsigned i = 0; CSRegs[i]; ++i) {
-    if (Epiphany::GPR32RegClass.contains(CSRegs[i]) && !MF.getRegInfo().isPhysRegModified(CSRegs[i])) {
+    if (Epiphany::GPR32RegClass.contains(CSRegs[i]) &&
+        !SavedRegs.test(CSRegs[i]) && !MRI.isReserved(CSRegs[i])) {
       ExtraReg = CSRegs[i];
       break;
     }
   }
 
   if (ExtraReg != 0) {
-    //MF.getRegInfo().setPhysRegUsed(ExtraReg);
+    // Saving it in the prologue leaves it free for the scavenger everywhere
+    // else.
+    SavedRegs.set(ExtraReg);
   } else {
     // Create a stack slot for scavenging purposes. PrologEpilogInserter
     // helpfully places it near either SP or FP for us to avoid
@@ -412,6 +437,95 @@ EpiphanyFrameLowering::eliminateCallFramePseudoInstr(MachineFunction &MF,
   MBB.erase(MI);
 }
 
+/// If Even and Odd are the two halves of a DPR64 register and their save
+/// slots form one aligned doubleword, return that register so they can be
+/// saved and restored with a single strd/ldrd. Otherwise return 0.
+static unsigned getPairedCSR(const MachineFrameInfo &MFI,
+                             const TargetRegisterInfo *TRI,
+                             const CalleeSavedInfo &Even,
+                             const CalleeSavedInfo &Odd) {
+  unsigned DReg = TRI->getMatchingSuperReg(Even.getReg(), Epiphany::sub_even,
+                                           &Epiphany::DPR64RegClass);
+  if (!DReg || TRI->getSubReg(DReg, Epiphany::sub_odd) != Odd.getReg())
+    return 0;
+
+  int64_t EvenOffset = MFI.getObjectOffset(Even.getFrameIdx());
+  int64_t OddOffset = MFI.getObjectOffset(Odd.getFrameIdx());
+  if (EvenOffset % 8 != 0 || OddOffset != EvenOffset + 4)
+    return 0;
+
+  return DReg;
+}
+
+bool EpiphanyFrameLowering::assignCalleeSavedSpillSlots(
+    MachineFunction &MF, const TargetRegisterInfo *TRI,
+    std::vector<CalleeSavedInfo> &CSI) const {
+  MachineFrameInfo *MFI = MF.getFrameInfo();
+
+  // Pull out every even register whose odd partner is saved too; those go
+  // first, as adjacent entries, so that each pair lands in an 8-byte aligned
+  // slot. Everything else (LR, or half of a pair the function doesn't
+  // clobber) is saved singly below them.
+  std::vector<CalleeSavedInfo> Pairs, Singles;
+  for (unsigned i = 0, e = CSI.size(); i < e; ++i) {
+    unsigned Reg = CSI[i].getReg();
+    unsigned EvenSuper = TRI->getMatchingSuperReg(Reg, Epiphany::sub_even,
+                                                  &Epiphany::DPR64RegClass);
+    unsigned OddSuper = TRI->getMatchingSuperReg(Reg, Epiphany::sub_odd,
+                                                 &Epiphany::DPR64RegClass);
+    unsigned Partner = 0;
+    if (EvenSuper)
+      Partner = TRI->getSubReg(EvenSuper, Epiphany::sub_odd);
+    else if (OddSuper)
+      Partner = TRI->getSubReg(OddSuper, Epiphany::sub_even);
+
+    bool PartnerSaved = false;
+    for (unsigned j = 0; j < e && Partner; ++j)
+      if (CSI[j].getReg() == Partner)
+        PartnerSaved = true;
+
+    if (!PartnerSaved) {
+      Singles.push_back(CSI[i]);
+    } else if (EvenSuper) {
+      Pairs.push_back(CSI[i]);
+      Pairs.push_back(CalleeSavedInfo(Partner));
+    }
+    // An odd register with a saved partner was added along with it.
+  }
+
+  // The slots hang directly below the incoming SP, which is 8-byte aligned,
+  // so laying the pairs out first keeps every one of them aligned.
+  int64_t Offset = 0;
+  for (unsigned i = 0, e = Pairs.size(); i < e; i += 2) {
+    Offset -= 8;
+    Pairs[i].setFrameIdx(MFI->CreateFixedSpillStackObject(4, Offset));
+    Pairs[i + 1].setFrameIdx(MFI->CreateFixedSpillStackObject(4, Offset + 4));
+  }
+  for (unsigned i = 0, e = Singles.size(); i < e; ++i) {
+    Offset -= 4;
+    Singles[i].setFrameIdx(MFI->CreateFixedSpillStackObject(4, Offset));
+  }
+
+  CSI = Pairs;
+  CSI.insert(CSI.end(), Singles.begin(), Singles.end());
+  return true;
+}
+
+void EpiphanyFrameLowering::getCalleeSavedFrameIndexRange(
+    const MachineFrameInfo &MFI, int &MinCSFI, int &MaxCSFI) const {
+  const std::vector<CalleeSavedInfo> &CSI = MFI.getCalleeSavedInfo();
+  MinCSFI = 0;
+  MaxCSFI = -1;
+
+  for (unsigned i = 0, e = CSI.size(); i < e; ++i) {
+    int FrameIdx = CSI[i].getFrameIdx();
+    if (i == 0 || FrameIdx < MinCSFI)
+      MinCSFI = FrameIdx;
+    if (i == 0 || FrameIdx > MaxCSFI)
+      MaxCSFI = FrameIdx;
+  }
+}
+
 void
 EpiphanyFrameLowering::emitFrameMemOps(bool isPrologue, MachineBasicBlock &MBB,
                                       MachineBasicBlock::iterator MBBI,
@@ -422,76 +536,51 @@ EpiphanyFrameLowering::emitFrameMemOps(bool isPrologue, MachineBasicBlock &MBB,
   MachineFrameInfo &MFI = *MF.getFrameInfo();
   const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
 
-  // A certain amount of implicit contract is present here. The actual stack
-  // offsets haven't been allocated officially yet, so for strictly correct code
-  // we rely on the fact that the elements of CSI are allocated in order
-  // starting at SP, purely as dictated by size and alignment. In practice since
-  // this function handles the only accesses to those slots it's not quite so
-  // important.
-  //
-  // We have also ordered the Callee-saved register list in EpiphanyCallingConv
-  // so that the above scheme puts registers in order: in particular we want
-  // &W30 to be &R11+8 for an ABI-correct frame record (PCS 5.2.2)
+  // assignCalleeSavedSpillSlots has already given every register a fixed slot
+  // and put each even/odd pair next to each other in CSI, so all that's left
+  // is to spot the pairs again and use one doubleword access for them.
   for (unsigned i = 0, e = CSI.size(); i < e; ++i) {
     unsigned Reg = CSI[i].getReg();
+    int FrameIdx = CSI[i].getFrameIdx();
+
+    unsigned PairReg = 0;
+    if (i + 1 < e)
+      PairReg = getPairedCSR(MFI, TRI, CSI[i], CSI[i + 1]);
 
-	// Let's try a double store first: regs must be a even-odd pair
     MachineInstrBuilder NewMI;
-    bool Pair = false;
-
-	// alignment?
-	//unsigned suba, subb, sra=0, srb=0;
-	//if(i+1 < CSI.size()){
-	//	suba = CSI[i].getReg();
-	//	subb = CSI[i+1].getReg();
-	//	sra = TRI->getMatchingSuperReg (suba, Epiphany::sub_even, &Epiphany::DPR64RegClass);
-	//	srb = TRI->getMatchingSuperReg (subb, Epiphany::sub_odd, &Epiphany::DPR64RegClass);
-	//	if( (!sra || !srb) || sra != srb){
-	//		srb = TRI->getMatchingSuperReg (suba, Epiphany::sub_odd, &Epiphany::DPR64RegClass);
-	//		sra = TRI->getMatchingSuperReg (subb, Epiphany::sub_even, &Epiphany::DPR64RegClass);
-	//		std::swap(suba,subb);
-	//	}
-	//}
-	//if ((sra && srb) && sra == srb) {
-	//	Pair = true;
-	//	unsigned StLow = 0, StHigh = 0;
-	//	if (isPrologue) {
-	//	// Most of these registers will be live-in to the MBB and killed by our
-	//	// store, though there are exceptions (see determinePrologueDeath).
-	//	StLow = getKillRegState(determinePrologueDeath(MBB, CSI[i+1].getReg()));
-	//	StHigh = getKillRegState(determinePrologueDeath(MBB, CSI[i].getReg()));
-	//	} else {
-	//	StLow = RegState::Define;
-	//	StHigh = RegState::Define;
-	//	}
-
-	//	//HACK FIXME liveness is a bit wrong...
-	//	NewMI = BuildMI(MBB, MBBI, DL, TII.get(isPrologue ? Epiphany::LSFP64_STR : Epiphany::LSFP64_LDR))
-	//		.addReg(sra, RegState::Kill);
-	//			//.addReg(suba, StLow)
-	//			//.addReg(subb, StHigh | RegState::Implicit);
-
-	//	// If it's a paired op, we've consumed two registers
-	//	++i;
-	//}
-	//else {
-      unsigned State;
+    unsigned State;
+    if (PairReg) {
       if (isPrologue) {
-        State = getKillRegState(determinePrologueDeath(MBB, CSI[i].getReg()));
+        // Most of these registers will be live-in to the MBB and killed by
+        // our store, though there are exceptions (see determinePrologueDeath).
+        bool KillEven = determinePrologueDeath(MBB, Reg);
+        bool KillOdd = determinePrologueDeath(MBB, CSI[i + 1].getReg());
+        State = getKillRegState(KillEven && KillOdd);
       } else {
         State = RegState::Define;
       }
 
-      NewMI = BuildMI(MBB, MBBI, DL, TII.get(isPrologue ? Epiphany::LS32_STR : Epiphany::LS32_LDR))
-                .addReg(CSI[i].getReg(), State);
-    //}
+      NewMI = BuildMI(MBB, MBBI, DL, TII.get(isPrologue ? Epiphany::LSFP64_STR
+                                                        : Epiphany::LSFP64_LDR))
+                .addReg(PairReg, State);
 
-	// Are we grabbing the right index? FIXME
-    int FrameIdx = CSI[Pair ? i-1 : i].getFrameIdx();
+      // If it's a paired op, we've consumed two registers
+      ++i;
+    } else {
+      if (isPrologue) {
+        State = getKillRegState(determinePrologueDeath(MBB, Reg));
+      } else {
+        State = RegState::Define;
+      }
+
+      NewMI = BuildMI(MBB, MBBI, DL, TII.get(isPrologue ? Epiphany::LS32_STR
+                                                        : Epiphany::LS32_LDR))
+                .addReg(Reg, State);
+    }
 
     MachineMemOperand *MMO = MF.getMachineMemOperand(MachinePointerInfo::getFixedStack(FrameIdx),
                              isPrologue ? MachineMemOperand::MOStore : MachineMemOperand::MOLoad,
-                             Pair ? 8 : 4,
+                             PairReg ? 8 : 4,
                              MFI.getObjectAlignment(FrameIdx));
 
     NewMI.addFrameIndex(FrameIdx).addImm(0)/*address-register offset*/.addMemOperand(MMO);
@@ -19,6 +19,8 @@
 
 namespace llvm {
 
+class MachineFrameInfo;
+
 class EpiphanyFrameLowering : public TargetFrameLowering {
 private:
   // In order to unify the spilling and restoring of callee-saved registers into
@@ -47,6 +49,11 @@ public:
   virtual void emitPrologue(MachineFunction &MF, MachineBasicBlock &MBB) const override;
   virtual void emitEpilogue(MachineFunction &MF, MachineBasicBlock &MBB) const override;
 
+  /// The prologue and epilogue can be moved off the entry and return blocks
+  /// as long as the SP adjustment doesn't clobber anything live there.
+  bool enableShrinkWrapping(const MachineFunction &MF) const override;
+  bool canUseAsEpilogue(const MachineBasicBlock &MBB) const override;
+
   /// Decides how much stack adjustment to perform in each phase of the prologue
   /// and epilogue.
   void splitSPAdjustments(uint64_t Total, uint64_t &Initial,
@@ -56,8 +63,22 @@ public:
                                      unsigned &FrameReg, int SPAdj,
                                      bool IsCalleeSaveOp) const;
 
-  virtual void processFunctionBeforeCalleeSavedScan(MachineFunction &MF,
-                                                    RegScavenger *RS) const;
+  /// Make sure the scavenger has a register or a slot to work with when the
+  /// frame is too big for immediate offsets.
+  void determineCalleeSaves(MachineFunction &MF, BitVector &SavedRegs,
+                            RegScavenger *RS) const override;
+
+  /// Give each callee-saved register a fixed slot just below the incoming SP,
+  /// with even/odd pairs first so that they can share an 8-byte strd/ldrd.
+  bool assignCalleeSavedSpillSlots(MachineFunction &MF,
+                                   const TargetRegisterInfo *TRI,
+                                   std::vector<CalleeSavedInfo> &CSI) const
+    override;
+
+  /// The callee-saved slots are created together, so their frame indices form
+  /// a contiguous range. MaxCSFI < MinCSFI if there are none.
+  void getCalleeSavedFrameIndexRange(const MachineFrameInfo &MFI,
+                                     int &MinCSFI, int &MaxCSFI) const;
 
   virtual bool spillCalleeSavedRegisters(MachineBasicBlock &MBB,
                                         MachineBasicBlock::iterator MI,
@@ -0,0 +1,513 @@
+//===-- EpiphanyHardwareLoops.cpp - Epiphany zero-overhead loops ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains two passes that put counted inner loops on the LC/LS/LE
+// loop hardware.
+//
+// EpiphanyHardwareLoops runs before register allocation, while the code is
+// still in SSA form. It looks for single block innermost loops whose exit test
+// is "IV != Bound" on an induction variable stepped by a power of two,
+// computes the trip count in the preheader, loads LC/LS/LE there and replaces
+// the compare and Bcc with a HWLOOP_END terminator.
+//
+// EpiphanyHardwareLoopFixup runs just before emission, once the body can no
+// longer change. It aligns the loop start and pads the body with nops so it
+// meets the size and alignment rules of the loop hardware.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "epiphany-hwloops"
+#include "Epiphany.h"
+#include "EpiphanyInstrInfo.h"
+#include "EpiphanySubtarget.h"
+#include "Utils/EpiphanyBaseInfo.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumHWLoops, "Number of loops converted to hardware loops");
+
+// Bodies shorter than this are padded with nops.
+static const unsigned MinHWLoopBodyInsts = 4;
+
+namespace {
+
+class EpiphanyHardwareLoops : public MachineFunctionPass {
+  const EpiphanyInstrInfo *TII;
+  MachineRegisterInfo *MRI;
+
+public:
+  static char ID;
+  EpiphanyHardwareLoops() : MachineFunctionPass(ID) {}
+
+  const char *getPassName() const override {
+    return "Epiphany hardware loops";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    AU.addRequired<MachineLoopInfo>();
+    AU.addPreserved<MachineLoopInfo>();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  bool convertToHardwareLoop(MachineLoop *L);
+  unsigned materializeImm(MachineBasicBlock &MBB, MachineBasicBlock::iterator I,
+                          DebugLoc DL, int32_t Val);
+  unsigned computeTripCount(MachineBasicBlock &MBB,
+                            MachineBasicBlock::iterator I, DebugLoc DL,
+                            unsigned InitReg, unsigned BoundReg,
+                            int64_t BoundImm, int64_t Step, bool TestsNext);
+  void emitLoopAddress(MachineBasicBlock &MBB, MachineBasicBlock::iterator I,
+                       DebugLoc DL, unsigned SpecialReg,
+                       MachineBasicBlock *Body, unsigned Flags);
+};
+
+char EpiphanyHardwareLoops::ID = 0;
+
+class EpiphanyHardwareLoopFixup : public MachineFunctionPass {
+public:
+  static char ID;
+  EpiphanyHardwareLoopFixup() : MachineFunctionPass(ID) {}
+
+  const char *getPassName() const override {
+    return "Epiphany hardware loop alignment";
+  }
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+};
+
+char EpiphanyHardwareLoopFixup::ID = 0;
+
+} // end anonymous namespace
+
+/// Does MI touch any of the loop registers? If so somebody else (inline asm,
+/// intrinsics) is using the loop hardware and we keep out of the way.
+static bool usesLoopRegs(const MachineInstr &MI) {
+  for (unsigned i = 0, e = MI.getNumOperands(); i != e; ++i) {
+    const MachineOperand &MO = MI.getOperand(i);
+    if (!MO.isReg())
+      continue;
+    if (MO.getReg() == Epiphany::LC || MO.getReg() == Epiphany::LS ||
+        MO.getReg() == Epiphany::LE)
+      return true;
+  }
+  return false;
+}
+
+/// Returns the value a PHI takes when entered from MBB, or 0.
+static unsigned getPHIIncoming(const MachineInstr *Phi,
+                               const MachineBasicBlock *MBB) {
+  for (unsigned i = 1, e = Phi->getNumOperands(); i != e; i += 2)
+    if (Phi->getOperand(i + 1).getMBB() == MBB)
+      return Phi->getOperand(i).getReg();
+  return 0;
+}
+
+/// If MI steps a register by an immediate, return the old and new register
+/// and the step. Post-increment loads and stores count too, since ISel folds
+/// pointer IVs into them.
+static bool getIVUpdate(const MachineInstr *MI, unsigned &Src, unsigned &Dst,
+                        int64_t &Step) {
+  int MemSize;
+  switch (MI->getOpcode()) {
+  default:
+    return false;
+  case Epiphany::ADDri:
+  case Epiphany::SUBri:
+    Dst = MI->getOperand(0).getReg();
+    Src = MI->getOperand(1).getReg();
+    Step = MI->getOperand(2).getImm();
+    if (MI->getOpcode() == Epiphany::SUBri)
+      Step = -Step;
+    return true;
+  case Epiphany::LS8_PostInd_LDR:    MemSize = 1; break;
+  case Epiphany::LS16_PostInd_LDR:   MemSize = 2; break;
+  case Epiphany::LS32_PostInd_LDR:
+  case Epiphany::LSFP32_PostInd_LDR: MemSize = 4; break;
+  case Epiphany::LSFP64_PostInd_LDR: MemSize = 8; break;
+  case Epiphany::LS8_PostInd_STR:    MemSize = 1; break;
+  case Epiphany::LS16_PostInd_STR:   MemSize = 2; break;
+  case Epiphany::LS32_PostInd_STR:
+  case Epiphany::LSFP32_PostInd_STR: MemSize = 4; break;
+  case Epiphany::LSFP64_PostInd_STR: MemSize = 8; break;
+  }
+
+  // Loads are (Rt, Rn_wb, Rn, Imm), stores are (Rn_wb, Rt, Rn, Imm).
+  Dst = MI->mayLoad() ? MI->getOperand(1).getReg() : MI->getOperand(0).getReg();
+  Src = MI->getOperand(2).getReg();
+  Step = MI->getOperand(3).getImm() * MemSize;
+  return true;
+}
+
+/// If Reg is a constant built by a single MOVri or MOVi32imm, return it in
+/// Val.
+static bool getImmDef(const MachineRegisterInfo *MRI, unsigned Reg,
+                      int64_t &Val) {
+  const MachineInstr *MI = MRI->getVRegDef(Reg);
+  if (!MI || !MI->getOperand(1).isImm())
+    return false;
+  switch (MI->getOpcode()) {
+  default:
+    return false;
+  case Epiphany::MOVri:
+    // A MOVri feeding a MOVTri carries the whole constant.
+    Val = MI->getOperand(1).getImm();
+    return isUInt<16>(Val);
+  case Epiphany::MOVi32imm:
+    Val = SignExtend64<32>(MI->getOperand(1).getImm());
+    return true;
+  }
+}
+
+/// Is Reg defined outside the (single block) loop Body?
+static bool isLoopInvariant(const MachineRegisterInfo *MRI, unsigned Reg,
+                            const MachineBasicBlock *Body) {
+  if (!TargetRegisterInfo::isVirtualRegister(Reg))
+    return false;
+  const MachineInstr *MI = MRI->getVRegDef(Reg);
+  return MI && MI->getParent() != Body;
+}
+
+unsigned
+EpiphanyHardwareLoops::materializeImm(MachineBasicBlock &MBB,
+                                      MachineBasicBlock::iterator I,
+                                      DebugLoc DL, int32_t Val) {
+  // Same choice as TrySelectToMoveImm.
+  unsigned Reg = MRI->createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned Opc = ((uint32_t)Val & 0xffff0000) ? Epiphany::MOVi32imm
+                                              : Epiphany::MOVri;
+  BuildMI(MBB, I, DL, TII->get(Opc), Reg).addImm((uint32_t)Val);
+  return Reg;
+}
+
+/// Emit code computing the number of times the loop body runs. The loop
+/// continues while X != Bound, where X is either the induction variable
+/// (TestsNext false) or its stepped value (TestsNext true). Step is a power of
+/// two, so a well-formed loop has (Bound - Init) divisible by it.
+unsigned
+EpiphanyHardwareLoops::computeTripCount(MachineBasicBlock &MBB,
+                                        MachineBasicBlock::iterator I,
+                                        DebugLoc DL, unsigned InitReg,
+                                        unsigned BoundReg, int64_t BoundImm,
+                                        int64_t Step, bool TestsNext) {
+  int64_t InitImm;
+  if (!BoundReg && getImmDef(MRI, InitReg, InitImm)) {
+    int64_t Dist = BoundImm - InitImm;
+    if (Dist % Step != 0)
+      return 0;
+    int64_t Count = Dist / Step + (TestsNext ? 0 : 1);
+    if (Count <= 0 || !isInt<32>(Count))
+      return 0;
+    return materializeImm(MBB, I, DL, Count);
+  }
+
+  if (!BoundReg)
+    BoundReg = materializeImm(MBB, I, DL, BoundImm);
+
+  unsigned Dist = MRI->createVirtualRegister(&Epiphany::GPR32RegClass);
+  if (Step > 0)
+    BuildMI(MBB, I, DL, TII->get(Epiphany::SUBrr), Dist)
+      .addReg(BoundReg).addReg(InitReg);
+  else
+    BuildMI(MBB, I, DL, TII->get(Epiphany::SUBrr), Dist)
+      .addReg(InitReg).addReg(BoundReg);
+
+  unsigned Count = Dist;
+  uint64_t AbsStep = Step > 0 ? Step : -Step;
+  if (AbsStep != 1) {
+    Count = MRI->createVirtualRegister(&Epiphany::GPR32RegClass);
+    BuildMI(MBB, I, DL, TII->get(Epiphany::LSRri), Count)
+      .addReg(Dist).addImm(Log2_64(AbsStep));
+  }
+
+  if (!TestsNext) {
+    unsigned Inc = MRI->createVirtualRegister(&Epiphany::GPR32RegClass);
+    BuildMI(MBB, I, DL, TII->get(Epiphany::ADDri), Inc)
+      .addReg(Count).addImm(1);
+    Count = Inc;
+  }
+
+  return Count;
+}
+
+/// Load the address of Body (or of its last instruction, with
+/// MO_HWLOOP_END in Flags) into LS/LE.
+void EpiphanyHardwareLoops::emitLoopAddress(MachineBasicBlock &MBB,
+                                            MachineBasicBlock::iterator I,
+                                            DebugLoc DL, unsigned SpecialReg,
+                                            MachineBasicBlock *Body,
+                                            unsigned Flags) {
+  unsigned Lo = MRI->createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned Addr = MRI->createVirtualRegister(&Epiphany::GPR32RegClass);
+  BuildMI(MBB, I, DL, TII->get(Epiphany::MOVri_nopat), Lo)
+    .addMBB(Body, Flags | EpiphanyII::MO_LO16);
+  BuildMI(MBB, I, DL, TII->get(Epiphany::MOVTri_nopat), Addr)
+    .addReg(Lo)
+    .addMBB(Body, Flags | EpiphanyII::MO_HI16);
+  BuildMI(MBB, I, DL, TII->get(Epiphany::MOVTS), SpecialReg).addReg(Addr);
+}
+
+bool EpiphanyHardwareLoops::convertToHardwareLoop(MachineLoop *L) {
+  MachineBasicBlock *Header = L->getHeader();
+  MachineBasicBlock *Preheader = L->getLoopPreheader();
+  MachineBasicBlock *Exit = L->getExitBlock();
+
+  // LS..LE has to be one contiguous range, so stick to single block loops.
+  if (L->getNumBlocks() != 1 || !Preheader || !Exit)
+    return false;
+
+  // A callee may use the loop hardware itself.
+  for (MachineBasicBlock::iterator I = Header->begin(), E = Header->end();
+       I != E; ++I)
+    if (I->isCall() || I->isInlineAsm() || usesLoopRegs(*I))
+      return false;
+
+  MachineBasicBlock *TBB = nullptr, *FBB = nullptr;
+  SmallVector<MachineOperand, 2> Cond;
+  if (TII->AnalyzeBranch(*Header, TBB, FBB, Cond) || Cond.empty() ||
+      Cond[0].getImm() != Epiphany::Bcc)
+    return false;
+
+  // The loop has to keep going while the tested value is not equal to the
+  // bound, whichever way round the branch is written.
+  EpiphanyCC::CondCodes CC = (EpiphanyCC::CondCodes)Cond[1].getImm();
+  if (!((TBB == Header && CC == EpiphanyCC::NE) ||
+        (TBB == Exit && FBB == Header && CC == EpiphanyCC::EQ)))
+    return false;
+
+  // Find what sets the flags for the Bcc and make sure nothing else reads them.
+  MachineBasicBlock::iterator Term = Header->getFirstTerminator();
+  MachineInstr *FlagDef = nullptr;
+  for (MachineBasicBlock::iterator I = Term; I != Header->begin();) {
+    --I;
+    if (I->isDebugValue())
+      continue;
+    if (I->definesRegister(Epiphany::NZCV)) {
+      FlagDef = I;
+      break;
+    }
+    if (I->readsRegister(Epiphany::NZCV))
+      return false;
+  }
+  if (!FlagDef)
+    return false;
+
+  unsigned TestReg = 0, BoundReg = 0;
+  int64_t BoundImm = 0;
+  bool EraseCmp = true;
+  switch (FlagDef->getOpcode()) {
+  default:
+    return false;
+  case Epiphany::CMPrr: {
+    // One side is the IV, the other has to be loop invariant.
+    unsigned LHS = FlagDef->getOperand(1).getReg();
+    unsigned RHS = FlagDef->getOperand(2).getReg();
+    if (isLoopInvariant(MRI, RHS, Header)) {
+      TestReg = LHS;
+      BoundReg = RHS;
+    } else if (isLoopInvariant(MRI, LHS, Header)) {
+      TestReg = RHS;
+      BoundReg = LHS;
+    } else
+      return false;
+    if (MRI->getRegClass(BoundReg) != &Epiphany::GPR32RegClass)
+      return false;
+    break;
+  }
+  case Epiphany::SUBri_cmp:
+    TestReg = FlagDef->getOperand(1).getReg();
+    BoundImm = FlagDef->getOperand(2).getImm();
+    break;
+  case Epiphany::ADDri:
+  case Epiphany::SUBri:
+    // optimizeCompareInstr has folded a compare against zero into the update.
+    TestReg = FlagDef->getOperand(0).getReg();
+    EraseCmp = false;
+    break;
+  }
+
+  if (!TargetRegisterInfo::isVirtualRegister(TestReg))
+    return false;
+
+  // TestReg is either the header PHI or the PHI stepped by an immediate.
+  MachineInstr *Phi = nullptr, *Update = nullptr;
+  bool TestsNext;
+  MachineInstr *TestDef = MRI->getVRegDef(TestReg);
+  if (TestDef->isPHI()) {
+    Phi = TestDef;
+    TestsNext = false;
+    unsigned NextReg = getPHIIncoming(Phi, Header);
+    if (!NextReg)
+      return false;
+    Update = MRI->getVRegDef(NextReg);
+  } else {
+    Update = TestDef;
+    TestsNext = true;
+  }
+
+  unsigned UpdSrc, UpdDst;
+  int64_t Step;
+  if (!Update || !getIVUpdate(Update, UpdSrc, UpdDst, Step))
+    return false;
+  if (TestsNext) {
+    if (UpdDst != TestReg)
+      return false;
+    Phi = MRI->getVRegDef(UpdSrc);
+  }
+
+  if (!Phi || !Phi->isPHI() || Phi->getParent() != Header ||
+      Update->getParent() != Header ||
+      UpdSrc != Phi->getOperand(0).getReg() ||
+      getPHIIncoming(Phi, Header) != UpdDst)
+    return false;
+
+  // The flags from the update itself only say something about the new value.
+  if (!EraseCmp && !TestsNext)
+    return false;
+
+  uint64_t AbsStep = Step > 0 ? Step : -Step;
+  if (!Step || !isPowerOf2_64(AbsStep))
+    return false;
+
+  unsigned InitReg = getPHIIncoming(Phi, Preheader);
+  if (!InitReg || MRI->getRegClass(InitReg) != &Epiphany::GPR32RegClass)
+    return false;
+
+  MachineBasicBlock::iterator InsertPos = Preheader->getFirstTerminator();
+  DebugLoc DL = Term->getDebugLoc();
+  unsigned Count = computeTripCount(*Preheader, InsertPos, DL, InitReg,
+                                    BoundReg, BoundImm, Step, TestsNext);
+  if (!Count)
+    return false;
+
+  DEBUG(dbgs() << "Hardware loop: BB#" << Header->getNumber()
+               << ", step " << Step << "\n");
+
+  BuildMI(*Preheader, InsertPos, DL, TII->get(Epiphany::MOVTS), Epiphany::LC)
+    .addReg(Count);
+  emitLoopAddress(*Preheader, InsertPos, DL, Epiphany::LS, Header, 0);
+  emitLoopAddress(*Preheader, InsertPos, DL, Epiphany::LE, Header,
+                  EpiphanyII::MO_HWLOOP_END);
+
+  // Swap the compare and branch for the loop end marker.
+  TII->RemoveBranch(*Header);
+  BuildMI(*Header, Header->end(), DL, TII->get(Epiphany::HWLOOP_END))
+    .addMBB(Header);
+  if (!Header->isLayoutSuccessor(Exit))
+    BuildMI(*Header, Header->end(), DL, TII->get(Epiphany::Bimm)).addMBB(Exit);
+
+  if (EraseCmp)
+    FlagDef->eraseFromParent();
+
+  // If the IV only fed the exit test it is dead now as well. A post-increment
+  // access still has its memory side to do, so leave that alone.
+  unsigned PhiReg = Phi->getOperand(0).getReg();
+  if (!Update->mayLoadOrStore() && MRI->hasOneNonDBGUse(PhiReg) &&
+      MRI->hasOneNonDBGUse(UpdDst)) {
+    MRI->markUsesInDebugValueAsUndef(PhiReg);
+    MRI->markUsesInDebugValueAsUndef(UpdDst);
+    Update->eraseFromParent();
+    Phi->eraseFromParent();
+  }
+
+  ++NumHWLoops;
+  return true;
+}
+
+bool EpiphanyHardwareLoops::runOnMachineFunction(MachineFunction &MF) {
+  // An interrupt handler would clobber the loop registers of whatever it
+  // interrupted.
+  if (MF.getFunction()->hasFnAttribute("interrupt"))
+    return false;
+
+  TII = MF.getSubtarget<EpiphanySubtarget>().getInstrInfo();
+  MRI = &MF.getRegInfo();
+  MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+
+  // There is only one set of loop registers, so only innermost loops qualify.
+  bool Changed = false;
+  SmallVector<MachineLoop *, 8> Worklist(MLI.begin(), MLI.end());
+  while (!Worklist.empty()) {
+    MachineLoop *L = Worklist.pop_back_val();
+    if (!L->empty()) {
+      Worklist.append(L->begin(), L->end());
+      continue;
+    }
+    Changed |= convertToHardwareLoop(L);
+  }
+  return Changed;
+}
+
+bool EpiphanyHardwareLoopFixup::runOnMachineFunction(MachineFunction &MF) {
+  const EpiphanyInstrInfo *TII =
+    MF.getSubtarget<EpiphanySubtarget>().getInstrInfo();
+  bool Changed = false;
+
+  for (MachineFunction::iterator MBB = MF.begin(), E = MF.end(); MBB != E;
+       ++MBB) {
+    MachineBasicBlock::iterator End = MBB->getFirstTerminator();
+    if (End == MBB->end() || End->getOpcode() != Epiphany::HWLOOP_END)
+      continue;
+    assert(End->getOperand(0).getMBB() == &*MBB &&
+           "hardware loop must branch back to its own block");
+
+    // Count the instructions between LS and LE. The loop hardware only deals
+    // with 32-bit instructions.
+    unsigned NumInsts = 0;
+    for (MachineBasicBlock::iterator I = MBB->begin(); I != End; ++I) {
+      unsigned Size = TII->getInstSizeInBytes(*I);
+      if (!Size)
+        continue;
+      assert(Size == 4 && "16-bit instruction in a hardware loop");
+      ++NumInsts;
+    }
+
+    // LS has to be doubleword aligned, and so does the next-to-last
+    // instruction, which means an even number of instructions in the body.
+    unsigned NumNops = 0;
+    if (NumInsts < MinHWLoopBodyInsts)
+      NumNops = MinHWLoopBodyInsts - NumInsts;
+    if ((NumInsts + NumNops) % 2)
+      ++NumNops;
+
+    DebugLoc DL = End->getDebugLoc();
+    for (unsigned i = 0; i != NumNops; ++i)
+      BuildMI(*MBB, MBB->begin(), DL, TII->get(Epiphany::NOP));
+
+    MBB->setAlignment(3);
+    Changed = true;
+  }
+
+  return Changed;
+}
+
+//===----------------------------------------------------------------------===//
+//                         Public Constructor Functions
+//===----------------------------------------------------------------------===//
+
+FunctionPass *llvm::createEpiphanyHardwareLoopsPass() {
+  return new EpiphanyHardwareLoops();
+}
+
+FunctionPass *llvm::createEpiphanyHardwareLoopFixupPass() {
+  return new EpiphanyHardwareLoopFixup();
+}
@@ -52,8 +52,8 @@ public:
   }
 
   bool runOnMachineFunction(MachineFunction &MF) override {
-    //Subtarget = &MF.getSubtarget<EpiphanySubtarget>();
     TM.resetSubtarget(&MF);
+    Subtarget = &MF.getSubtarget<EpiphanySubtarget>();
     return SelectionDAGISel::runOnMachineFunction(MF);
   }
 
@@ -77,6 +77,8 @@ public:
   }
 
   SDNode *TrySelectToMoveImm(SDNode *N);
+  SDNode *SelectIndexedLoad(SDNode *N);
+  SDNode *SelectCompare(SDNode *N);
   SDNode *LowerToFPLitPool(SDNode *Node);
   SDNode *SelectToLitPool(SDNode *N);
 
@@ -85,6 +87,10 @@ private:
 };
 }
 
+/// TrySelectToMoveImm - A constant that fits in 16 bits is a single mov.
+/// Anything wider becomes a MOVi32imm/MOVf32imm pseudo, which the register
+/// allocator can rematerialise and which is only split into real instructions
+/// after allocation.
 SDNode *EpiphanyDAGToDAGISel::TrySelectToMoveImm(SDNode *Node) {
   SDNode *ResNode;
   SDLoc dl(Node);
@@ -100,27 +106,97 @@ SDNode *EpiphanyDAGToDAGISel::TrySelectToMoveImm(SDNode *Node) {
 				llvm_unreachable("wat.");
 		}
 
-	// 0 or 16 lower bits
-		ResNode = CurDAG->getMachineNode(Epiphany::MOVri, dl, DestType, CurDAG->getTargetConstant(BitPat, dl, MVT::i32));
-
-		if (BitPat & 0xffff0000ULL){// 16 upper bits
-			//this is LUi(LLi(val{15-0}), val{31-16})
-			ResNode = CurDAG->getMachineNode(Epiphany::MOVTri, dl, DestType, SDValue(ResNode, 0), CurDAG->getTargetConstant(BitPat, dl, MVT::i32));	 
-		}
+		SDValue Imm = CurDAG->getTargetConstant(BitPat, dl, MVT::i32);
+		if (BitPat & 0xffff0000ULL)
+			ResNode = CurDAG->getMachineNode(Epiphany::MOVi32imm, dl, DestType, Imm);
+		else
+			ResNode = CurDAG->getMachineNode(Epiphany::MOVri, dl, DestType, Imm);
 	} else if(DestType.isFloatingPoint()){
 		APFloat BitPat = cast<ConstantFPSDNode>(Node)->getValueAPF();
 
-		ResNode = CurDAG->getMachineNode(Epiphany::MOVri_nopat_f, dl, DestType, CurDAG->getTargetConstantFP(BitPat, dl, MVT::f32));
-		//this is LUi(LLi(val{15-0}), val{31-16})
-		if(!BitPat.isPosZero())
-		ResNode = CurDAG->getMachineNode(Epiphany::MOVTri_nopat_f, dl, DestType, SDValue(ResNode, 0), CurDAG->getTargetConstantFP(BitPat, dl, MVT::f32));	 
-
+		SDValue Imm = CurDAG->getTargetConstantFP(BitPat, dl, MVT::f32);
+		if (BitPat.bitcastToAPInt().getZExtValue() & 0xffff0000ULL)
+			ResNode = CurDAG->getMachineNode(Epiphany::MOVf32imm, dl, DestType, Imm);
+		else
+			ResNode = CurDAG->getMachineNode(Epiphany::MOVri_nopat_f, dl, DestType, Imm);
 	}
 
 	ReplaceUses(Node, ResNode);
 	return ResNode;
 }
 
+/// SelectIndexedLoad - Select a post-increment load. These produce both the
+/// loaded value and the updated base, which TableGen patterns can't express.
+SDNode *EpiphanyDAGToDAGISel::SelectIndexedLoad(SDNode *Node) {
+  LoadSDNode *LD = cast<LoadSDNode>(Node);
+  if (LD->getAddressingMode() != ISD::POST_INC)
+    return NULL;
+
+  SDValue Offset;
+  unsigned Opcode;
+  bool Match;
+  switch (LD->getMemoryVT().getSimpleVT().SimpleTy) {
+  case MVT::i8:
+    Opcode = Epiphany::LS8_PostInd_LDR;
+    Match = SelectOffsetUImm11<1>(LD->getOffset(), Offset);
+    break;
+  case MVT::i16:
+    Opcode = Epiphany::LS16_PostInd_LDR;
+    Match = SelectOffsetUImm11<2>(LD->getOffset(), Offset);
+    break;
+  case MVT::i32:
+    Opcode = Epiphany::LS32_PostInd_LDR;
+    Match = SelectOffsetUImm11<4>(LD->getOffset(), Offset);
+    break;
+  case MVT::f32:
+    Opcode = Epiphany::LSFP32_PostInd_LDR;
+    Match = SelectOffsetUImm11<4>(LD->getOffset(), Offset);
+    break;
+  default:
+    return NULL;
+  }
+  if (!Match)
+    return NULL;
+
+  SDValue Ops[] = { LD->getBasePtr(), Offset, LD->getChain() };
+  MachineSDNode *Res = CurDAG->getMachineNode(Opcode, SDLoc(Node),
+                                              LD->getValueType(0), MVT::i32,
+                                              MVT::Other, Ops);
+  MachineSDNode::mmo_iterator MemOp = MF->allocateMemRefsArray(1);
+  MemOp[0] = LD->getMemOperand();
+  Res->setMemRefs(MemOp, MemOp + 1);
+  return Res;
+}
+
+/// SelectCompare - Compares are subtractions whose difference nobody reads.
+/// The difference goes to a fresh virtual register that is dead on arrival,
+/// and the flags come out as the node's second result.
+SDNode *EpiphanyDAGToDAGISel::SelectCompare(SDNode *Node) {
+  SDLoc dl(Node);
+  SDValue LHS = Node->getOperand(0);
+  SDValue RHS = Node->getOperand(1);
+  EVT VT = LHS.getValueType();
+
+  unsigned Opcode;
+  SDValue Ops[2] = { LHS, RHS };
+  if (VT == MVT::f32) {
+    Opcode = Epiphany::FCMPss;
+  } else {
+    Opcode = Epiphany::CMPrr;
+    if (ConstantSDNode *CN = dyn_cast<ConstantSDNode>(RHS)) {
+      int64_t Imm = CN->getSExtValue();
+      if (Imm >= -1024 && Imm <= 1023) {
+        Opcode = Epiphany::SUBri_cmp;
+        Ops[1] = CurDAG->getTargetConstant(Imm, dl, MVT::i32);
+      }
+    }
+  }
+
+  SDNode *Cmp = CurDAG->getMachineNode(Opcode, dl, VT, MVT::i32, Ops);
+  ReplaceUses(SDValue(Node, 0), SDValue(Cmp, 1));
+  return NULL;
+}
+
 SDNode *EpiphanyDAGToDAGISel::SelectToLitPool(SDNode *Node) {
   SDLoc dl(Node);
   const DataLayout &DL = CurDAG->getDataLayout();
@@ -251,6 +327,13 @@ SDNode *EpiphanyDAGToDAGISel::Select(SDNode *Node) {
     //break;
 	return TrySelectToMoveImm(Node);
   }
+  case ISD::LOAD: {
+    if (SDNode *ResNode = SelectIndexedLoad(Node))
+      return ResNode;
+    break;
+  }
+  case EpiphanyISD::SETCC:
+    return SelectCompare(Node);
   default:
     break; // Let generic code handle it
   }
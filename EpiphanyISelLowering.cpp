@@ -15,6 +15,7 @@
 #define DEBUG_TYPE "epiphany-isel"
 #include "Epiphany.h"
 #include "EpiphanyISelLowering.h"
+#include "EpiphanyIntrinsicInfo.h"
 #include "EpiphanyMachineFunctionInfo.h"
 #include "EpiphanyTargetMachine.h"
 #include "EpiphanyTargetObjectFile.h"
@@ -26,9 +27,21 @@
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/TargetLoweringObjectFileImpl.h"
 #include "llvm/IR/CallingConv.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
 
 using namespace llvm;
 
+// A table dispatch is mov/movt/lsl/ldr/jr after the range check: one taken
+// branch whichever case is hit. A compare tree pays a compare per level and
+// flushes the pipeline on every taken branch on the way down, so tables win
+// from a small number of cases onwards.
+static cl::opt<int>
+MinJumpTableEntries("epiphany-min-jump-table-entries", cl::Hidden,
+                    cl::desc("Minimum number of cases to use a jump table"),
+                    cl::init(3));
+
 
 
 EpiphanyTargetLowering::EpiphanyTargetLowering(const TargetMachine &TM,
@@ -49,6 +62,7 @@ EpiphanyTargetLowering::EpiphanyTargetLowering(const TargetMachine &TM,
 
   setTargetDAGCombine(ISD::FADD);
   setTargetDAGCombine(ISD::FSUB);
+  setTargetDAGCombine(ISD::MUL);
 
   // Epiphany does not have i1 loads, or much of anything for i1 really.
   for (MVT VT : MVT::integer_valuetypes()) {
@@ -76,6 +90,7 @@ EpiphanyTargetLowering::EpiphanyTargetLowering(const TargetMachine &TM,
   setOperationAction(ISD::BRCOND, MVT::Other, Custom);
   setOperationAction(ISD::SETCC, MVT::i32, Custom);
   setOperationAction(ISD::SETCC, MVT::f32, Custom);
+  // BR_JT expands to a load from the table, indexed by [Rn, Rm], and a jr.
   setOperationAction(ISD::BR_JT, MVT::Other, Expand);
   setOperationAction(ISD::JumpTable, MVT::i32, Custom);
   setOperationAction(ISD::VASTART, MVT::Other, Expand);
@@ -83,6 +98,9 @@ EpiphanyTargetLowering::EpiphanyTargetLowering(const TargetMachine &TM,
   setOperationAction(ISD::VAEND, MVT::Other, Expand);
   setOperationAction(ISD::VAARG, MVT::Other, Expand);
   setOperationAction(ISD::BlockAddress, MVT::i32, Custom);
+  // For llvm.epiphany.dma.set.desc; the other intrinsics are matched as is.
+  setOperationAction(ISD::INTRINSIC_W_CHAIN, MVT::Other, Custom);
+  setOperationAction(ISD::INTRINSIC_VOID, MVT::Other, Custom);
   setOperationAction(ISD::ROTL, MVT::i32, Expand);
   setOperationAction(ISD::UREM, MVT::i32, Expand);
   setOperationAction(ISD::UDIVREM, MVT::i32, Expand);
@@ -91,6 +109,17 @@ EpiphanyTargetLowering::EpiphanyTargetLowering(const TargetMachine &TM,
   setOperationAction(ISD::SDIV, MVT::i32, Expand);
   setOperationAction(ISD::UDIV, MVT::i32, Expand);
   setOperationAction(ISD::CTPOP, MVT::i32, Expand);
+  setOperationAction(ISD::BSWAP, MVT::i32, Expand);
+
+  // IMUL needs CONFIG switched to integer mode, which would also turn every
+  // floating-point instruction around it into an integer one, so multiply goes
+  // out to __mulsi3 (or is turned into shifts and adds by PerformMULCombine)
+  // on every core. There is no widening multiply either.
+  setOperationAction(ISD::MUL, MVT::i32, Expand);
+  setOperationAction(ISD::MULHS, MVT::i32, Expand);
+  setOperationAction(ISD::MULHU, MVT::i32, Expand);
+  setOperationAction(ISD::SMUL_LOHI, MVT::i32, Expand);
+  setOperationAction(ISD::UMUL_LOHI, MVT::i32, Expand);
 
   setOperationAction(ISD::FNEG, MVT::f32, Custom);
 
@@ -106,7 +135,10 @@ EpiphanyTargetLowering::EpiphanyTargetLowering(const TargetMachine &TM,
   //setOperationAction(ISD::FMA, MVT::f32, Expand); custom combine due to fneg, we have fmsub
 
   // Illegal floating-point operations.
+  // FDIV and FSQRT become libcalls unless unsafe-fp-math lets the DAG
+  // combiner use getRecipEstimate/getRsqrtEstimate instead.
   setOperationAction(ISD::FDIV, MVT::f32, Expand);
+  setOperationAction(ISD::FSQRT, MVT::f32, Expand);
   setOperationAction(ISD::FCOPYSIGN, MVT::f32, Expand);
   setOperationAction(ISD::FCOS, MVT::f32, Expand);
   setOperationAction(ISD::FEXP, MVT::f32, Expand);
@@ -124,6 +156,23 @@ EpiphanyTargetLowering::EpiphanyTargetLowering(const TargetMachine &TM,
   setOperationAction(ISD::FP_TO_SINT, MVT::i32, Legal);
   setOperationAction(ISD::SINT_TO_FP, MVT::i32, Legal);
 
+  // Post-increment loads and stores, "ldr r0, [r1], #imm".
+  for (MVT VT : {MVT::i8, MVT::i16, MVT::i32, MVT::f32}) {
+    setIndexedLoadAction(ISD::POST_INC, VT, Legal);
+    setIndexedStoreAction(ISD::POST_INC, VT, Legal);
+  }
+
+  // A taken branch flushes the pipeline; prefer movCC and computing both
+  // halves of "a && b" to extra conditional branches.
+  setJumpIsExpensive(true);
+  setMinimumJumpTableEntries(MinJumpTableEntries);
+
+  // Short copies and fills become word loads and stores, which the ldrd/strd
+  // pairing pass then combines. Longer ones of known size are turned into
+  // loops by EpiphanySelectionDAGInfo.
+  MaxStoresPerMemcpy = MaxStoresPerMemmove = MaxStoresPerMemset = 16;
+  MaxStoresPerMemcpyOptSize = MaxStoresPerMemmoveOptSize = 4;
+  MaxStoresPerMemsetOptSize = 4;
   }
 
 EVT EpiphanyTargetLowering::getSetCCResultType(EVT VT) const {
@@ -141,7 +190,320 @@ EpiphanyTargetLowering::EmitInstrWithCustomInserter(MachineInstr *MI,
   default: llvm_unreachable("Unhandled instruction with custom inserter");
   //case Epiphany::F128CSEL:
   //  return EmitF128CSEL(MI, MBB);
+  case Epiphany::MEMCPY_LOOP:
+  case Epiphany::MEMSET_LOOP:
+    return EmitMemOpLoop(MI, MBB);
+  case Epiphany::DMA_START:
+    return EmitDMAStart(MI, MBB);
+  case Epiphany::DMA_START_DESC:
+    return EmitDMAStartDesc(MI, MBB);
+  case Epiphany::DMA_STATUS:
+    return EmitDMAStatus(MI, MBB);
+  case Epiphany::DMA_WAIT:
+    return EmitDMAWait(MI, MBB);
+  case Epiphany::CTIMER_SET:
+    return EmitCTimerSet(MI, MBB);
+  case Epiphany::CONFIG_UPDATE:
+    return EmitConfigUpdate(MI, MBB);
+  }
+}
+
+/// Channel registers written by DMA_START, in the order of its operands.
+static const MCPhysReg DMAStartRegs[2][5] = {
+  { Epiphany::DMA0DSTADDR, Epiphany::DMA0SRCADDR, Epiphany::DMA0STRIDE,
+    Epiphany::DMA0COUNT, Epiphany::DMA0CONFIG },
+  { Epiphany::DMA1DSTADDR, Epiphany::DMA1SRCADDR, Epiphany::DMA1STRIDE,
+    Epiphany::DMA1COUNT, Epiphany::DMA1CONFIG }
+};
+
+MachineBasicBlock *
+EpiphanyTargetLowering::EmitDMAStart(MachineInstr *MI,
+                                     MachineBasicBlock *MBB) const {
+  const TargetInstrInfo *TII = Subtarget->getInstrInfo();
+  DebugLoc DL = MI->getDebugLoc();
+  unsigned Chan = MI->getOperand(5).getImm();
+  assert(Chan < 2 && "Epiphany cores have two DMA channels");
+
+  // The config register goes last: writing it starts the transfer.
+  for (unsigned i = 0; i != 5; ++i)
+    BuildMI(*MBB, MI, DL, TII->get(Epiphany::MOVTS), DMAStartRegs[Chan][i])
+      .addOperand(MI->getOperand(i));
+
+  MI->eraseFromParent();
+  return MBB;
+}
+
+MachineBasicBlock *
+EpiphanyTargetLowering::EmitDMAStartDesc(MachineInstr *MI,
+                                         MachineBasicBlock *MBB) const {
+  const TargetInstrInfo *TII = Subtarget->getInstrInfo();
+  unsigned Chan = MI->getOperand(1).getImm();
+  assert(Chan < 2 && "Epiphany cores have two DMA channels");
+
+  BuildMI(*MBB, MI, MI->getDebugLoc(), TII->get(Epiphany::MOVTS),
+          Chan ? Epiphany::DMA1CONFIG : Epiphany::DMA0CONFIG)
+    .addOperand(MI->getOperand(0));
+
+  MI->eraseFromParent();
+  return MBB;
+}
+
+MachineBasicBlock *
+EpiphanyTargetLowering::EmitDMAStatus(MachineInstr *MI,
+                                      MachineBasicBlock *MBB) const {
+  const TargetInstrInfo *TII = Subtarget->getInstrInfo();
+  unsigned Chan = MI->getOperand(1).getImm();
+  assert(Chan < 2 && "Epiphany cores have two DMA channels");
+
+  BuildMI(*MBB, MI, MI->getDebugLoc(), TII->get(Epiphany::MOVFS),
+          MI->getOperand(0).getReg())
+    .addReg(Chan ? Epiphany::DMA1STATUS : Epiphany::DMA0STATUS);
+
+  MI->eraseFromParent();
+  return MBB;
+}
+
+/// Spin until the channel's DMASTATE (the low four bits of its status
+/// register) reads idle.
+MachineBasicBlock *
+EpiphanyTargetLowering::EmitDMAWait(MachineInstr *MI,
+                                    MachineBasicBlock *MBB) const {
+  const TargetInstrInfo *TII = Subtarget->getInstrInfo();
+  MachineFunction *MF = MBB->getParent();
+  MachineRegisterInfo &MRI = MF->getRegInfo();
+  DebugLoc DL = MI->getDebugLoc();
+  unsigned Chan = MI->getOperand(0).getImm();
+  assert(Chan < 2 && "Epiphany cores have two DMA channels");
+
+  const BasicBlock *LLVM_BB = MBB->getBasicBlock();
+  MachineFunction::iterator It = ++MBB->getIterator();
+  MachineBasicBlock *LoopBB = MF->CreateMachineBasicBlock(LLVM_BB);
+  MachineBasicBlock *ExitBB = MF->CreateMachineBasicBlock(LLVM_BB);
+  MF->insert(It, LoopBB);
+  MF->insert(It, ExitBB);
+  ExitBB->splice(ExitBB->begin(), MBB,
+                 std::next(MachineBasicBlock::iterator(MI)), MBB->end());
+  ExitBB->transferSuccessorsAndUpdatePHIs(MBB);
+  MBB->addSuccessor(LoopBB);
+  LoopBB->addSuccessor(LoopBB);
+  LoopBB->addSuccessor(ExitBB);
+
+  unsigned Status = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned State = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  BuildMI(LoopBB, DL, TII->get(Epiphany::MOVFS), Status)
+    .addReg(Chan ? Epiphany::DMA1STATUS : Epiphany::DMA0STATUS);
+  BuildMI(LoopBB, DL, TII->get(Epiphany::LSLri), State)
+    .addReg(Status, RegState::Kill)
+    .addImm(28);
+  BuildMI(LoopBB, DL, TII->get(Epiphany::Bcc))
+    .addImm(EpiphanyCC::NE)
+    .addMBB(LoopBB);
+
+  MI->eraseFromParent();
+  return ExitBB;
+}
+
+MachineBasicBlock *
+EpiphanyTargetLowering::EmitCTimerSet(MachineInstr *MI,
+                                      MachineBasicBlock *MBB) const {
+  const TargetInstrInfo *TII = Subtarget->getInstrInfo();
+  unsigned Timer = MI->getOperand(1).getImm();
+  assert(Timer < 2 && "Epiphany cores have two timers");
+
+  BuildMI(*MBB, MI, MI->getDebugLoc(), TII->get(Epiphany::MOVTS),
+          Timer ? Epiphany::CTIMER1 : Epiphany::CTIMER0)
+    .addOperand(MI->getOperand(0));
+
+  MI->eraseFromParent();
+  return MBB;
+}
+
+/// CONFIG = CONFIG ^ ((CONFIG ^ val) & mask), which needs no inverted mask.
+/// The call had a block to itself during selection (see
+/// EpiphanyConfigUpdateSplit), and every floating-point instruction reads
+/// CONFIG, so they stay in order with the write from here on.
+MachineBasicBlock *
+EpiphanyTargetLowering::EmitConfigUpdate(MachineInstr *MI,
+                                         MachineBasicBlock *MBB) const {
+  const TargetInstrInfo *TII = Subtarget->getInstrInfo();
+  MachineRegisterInfo &MRI = MBB->getParent()->getRegInfo();
+  DebugLoc DL = MI->getDebugLoc();
+  unsigned Mask = MI->getOperand(0).getReg();
+  unsigned Val = MI->getOperand(1).getReg();
+
+  unsigned Old = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned Diff = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned Masked = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned New = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  BuildMI(*MBB, MI, DL, TII->get(Epiphany::MOVFS), Old)
+    .addReg(Epiphany::CONFIG);
+  BuildMI(*MBB, MI, DL, TII->get(Epiphany::EORrr), Diff)
+    .addReg(Old)
+    .addReg(Val);
+  BuildMI(*MBB, MI, DL, TII->get(Epiphany::ANDrr), Masked)
+    .addReg(Diff, RegState::Kill)
+    .addReg(Mask);
+  BuildMI(*MBB, MI, DL, TII->get(Epiphany::EORrr), New)
+    .addReg(Old, RegState::Kill)
+    .addReg(Masked, RegState::Kill);
+  BuildMI(*MBB, MI, DL, TII->get(Epiphany::MOVTS), Epiphany::CONFIG)
+    .addReg(New, RegState::Kill);
+
+  MI->eraseFromParent();
+  return MBB;
+}
+
+/// Expand MEMCPY_LOOP / MEMSET_LOOP. The loop stores two units (doublewords
+/// if the destination is 8-byte aligned, words otherwise) per trip with
+/// post-incrementing ldrd/strd, loads ahead of stores. What is left over is
+/// copied straight-line after the loop, largest pieces first so every offset
+/// stays a multiple of its access size, again with all loads before the
+/// stores.
+MachineBasicBlock *
+EpiphanyTargetLowering::EmitMemOpLoop(MachineInstr *MI,
+                                      MachineBasicBlock *MBB) const {
+  const TargetInstrInfo *TII = Subtarget->getInstrInfo();
+  MachineFunction *MF = MBB->getParent();
+  MachineRegisterInfo &MRI = MF->getRegInfo();
+  DebugLoc DL = MI->getDebugLoc();
+  bool IsMemset = MI->getOpcode() == Epiphany::MEMSET_LOOP;
+
+  unsigned Dst = MI->getOperand(0).getReg();
+  unsigned SrcOrVal = MI->getOperand(1).getReg();
+  unsigned Size = MI->getOperand(2).getImm();
+  unsigned Align = MI->getOperand(3).getImm();
+  assert(Align >= 4 && "Memory op loop needs word alignment");
+
+  unsigned Unit = Align >= 8 ? 8 : 4;
+  unsigned Trips = Size / (2 * Unit);
+  unsigned Left = Size % (2 * Unit);
+  assert(Trips && "Memory op loop too short to be worth a loop");
+  const TargetRegisterClass *UnitRC =
+    Unit == 8 ? &Epiphany::DPR64RegClass : &Epiphany::GPR32RegClass;
+
+  // strd stores an even / odd pair, so memset wants the word in both halves.
+  unsigned UnitVal = SrcOrVal;
+  if (IsMemset && Unit == 8) {
+    UnitVal = MRI.createVirtualRegister(&Epiphany::DPR64RegClass);
+    BuildMI(*MBB, MI, DL, TII->get(TargetOpcode::REG_SEQUENCE), UnitVal)
+      .addReg(SrcOrVal)
+      .addImm(Epiphany::sub_even)
+      .addReg(SrcOrVal)
+      .addImm(Epiphany::sub_odd);
+  }
+
+  unsigned Count = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  BuildMI(*MBB, MI, DL,
+          TII->get(isUInt<16>(Trips) ? Epiphany::MOVri : Epiphany::MOVi32imm),
+          Count)
+    .addImm(Trips);
+
+  // Everything after the pseudo moves to ExitBB.
+  const BasicBlock *LLVM_BB = MBB->getBasicBlock();
+  MachineFunction::iterator It = ++MBB->getIterator();
+  MachineBasicBlock *LoopBB = MF->CreateMachineBasicBlock(LLVM_BB);
+  MachineBasicBlock *ExitBB = MF->CreateMachineBasicBlock(LLVM_BB);
+  MF->insert(It, LoopBB);
+  MF->insert(It, ExitBB);
+  ExitBB->splice(ExitBB->begin(), MBB,
+                 std::next(MachineBasicBlock::iterator(MI)), MBB->end());
+  ExitBB->transferSuccessorsAndUpdatePHIs(MBB);
+  MBB->addSuccessor(LoopBB);
+  LoopBB->addSuccessor(LoopBB);
+  LoopBB->addSuccessor(ExitBB);
+
+  // LoopBB: the body first, then the PHIs that feed it.
+  unsigned DstPhi = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned SrcPhi =
+    IsMemset ? 0 : MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned CountPhi = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  unsigned LdOpc = Unit == 8 ? Epiphany::LSFP64_PostInd_LDR
+                             : Epiphany::LS32_PostInd_LDR;
+  unsigned StOpc = Unit == 8 ? Epiphany::LSFP64_PostInd_STR
+                             : Epiphany::LS32_PostInd_STR;
+
+  unsigned Vals[2] = { UnitVal, UnitVal };
+  unsigned SrcNext = SrcPhi;
+  if (!IsMemset) {
+    for (unsigned i = 0; i != 2; ++i) {
+      unsigned NewSrc = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+      Vals[i] = MRI.createVirtualRegister(UnitRC);
+      BuildMI(LoopBB, DL, TII->get(LdOpc), Vals[i])
+        .addReg(NewSrc, RegState::Define)
+        .addReg(SrcNext)
+        .addImm(1);
+      SrcNext = NewSrc;
+    }
+  }
+  unsigned DstNext = DstPhi;
+  for (unsigned i = 0; i != 2; ++i) {
+    unsigned NewDst = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+    BuildMI(LoopBB, DL, TII->get(StOpc), NewDst)
+      .addReg(Vals[i])
+      .addReg(DstNext)
+      .addImm(1);
+    DstNext = NewDst;
+  }
+  unsigned CountNext = MRI.createVirtualRegister(&Epiphany::GPR32RegClass);
+  BuildMI(LoopBB, DL, TII->get(Epiphany::SUBri), CountNext)
+    .addReg(CountPhi)
+    .addImm(1);
+  BuildMI(LoopBB, DL, TII->get(Epiphany::Bcc))
+    .addImm(EpiphanyCC::NE)
+    .addMBB(LoopBB);
+
+  MachineBasicBlock::iterator Top = LoopBB->begin();
+  BuildMI(*LoopBB, Top, DL, TII->get(TargetOpcode::PHI), DstPhi)
+    .addReg(Dst).addMBB(MBB)
+    .addReg(DstNext).addMBB(LoopBB);
+  if (!IsMemset)
+    BuildMI(*LoopBB, Top, DL, TII->get(TargetOpcode::PHI), SrcPhi)
+      .addReg(SrcOrVal).addMBB(MBB)
+      .addReg(SrcNext).addMBB(LoopBB);
+  BuildMI(*LoopBB, Top, DL, TII->get(TargetOpcode::PHI), CountPhi)
+    .addReg(Count).addMBB(MBB)
+    .addReg(CountNext).addMBB(LoopBB);
+
+  // ExitBB: the tail, from the pointers the loop left behind.
+  static const unsigned PieceSizes[] = { 8, 4, 2, 1 };
+  static const unsigned PieceLdOpc[] = { Epiphany::LSFP64_LDR, Epiphany::LS32_LDR,
+                                         Epiphany::LS16_LDR, Epiphany::LS8_LDR };
+  static const unsigned PieceStOpc[] = { Epiphany::LSFP64_STR, Epiphany::LS32_STR,
+                                         Epiphany::LS16_STR, Epiphany::LS8_STR };
+  SmallVector<unsigned, 4> Pieces;
+  for (unsigned i = 0; i != array_lengthof(PieceSizes); ++i)
+    for (; PieceSizes[i] <= Unit && Left >= PieceSizes[i];
+         Left -= PieceSizes[i])
+      Pieces.push_back(i);
+
+  MachineBasicBlock::iterator InsertPt = ExitBB->begin();
+  SmallVector<unsigned, 4> PieceVals;
+  unsigned Offset = 0;
+  for (unsigned i : Pieces) {
+    unsigned Val = PieceSizes[i] == 8 ? UnitVal : SrcOrVal;
+    if (!IsMemset) {
+      Val = MRI.createVirtualRegister(PieceSizes[i] == 8
+                                        ? &Epiphany::DPR64RegClass
+                                        : &Epiphany::GPR32RegClass);
+      BuildMI(*ExitBB, InsertPt, DL, TII->get(PieceLdOpc[i]), Val)
+        .addReg(SrcNext)
+        .addImm(Offset / PieceSizes[i]);
+    }
+    PieceVals.push_back(Val);
+    Offset += PieceSizes[i];
   }
+  Offset = 0;
+  for (unsigned j = 0, e = Pieces.size(); j != e; ++j) {
+    unsigned i = Pieces[j];
+    BuildMI(*ExitBB, InsertPt, DL, TII->get(PieceStOpc[i]))
+      .addReg(PieceVals[j])
+      .addReg(DstNext)
+      .addImm(Offset / PieceSizes[i]);
+    Offset += PieceSizes[i];
+  }
+
+  MI->eraseFromParent();
+  return ExitBB;
 }
 
 
@@ -150,10 +512,15 @@ const char *EpiphanyTargetLowering::getTargetNodeName(unsigned Opcode) const {
   case EpiphanyISD::BR_CC:          return "EpiphanyISD::BR_CC";
   case EpiphanyISD::Call:           return "EpiphanyISD::Call";
   case EpiphanyISD::Ret:            return "EpiphanyISD::Ret";
+  case EpiphanyISD::TC_RETURN:      return "EpiphanyISD::TC_RETURN";
   case EpiphanyISD::SELECT_CC:      return "EpiphanyISD::SELECT_CC";
   case EpiphanyISD::SETCC:          return "EpiphanyISD::SETCC";
   case EpiphanyISD::WrapperSmall:   return "EpiphanyISD::WrapperSmall";
   case EpiphanyISD::FM_A_S:			return "EpiphanyISD::FM_A_S";
+  case EpiphanyISD::MEMCPY:         return "EpiphanyISD::MEMCPY";
+  case EpiphanyISD::MEMSET:         return "EpiphanyISD::MEMSET";
+  case EpiphanyISD::DMA_START:      return "EpiphanyISD::DMA_START";
+  case EpiphanyISD::DMA_WAIT:       return "EpiphanyISD::DMA_WAIT";
 
   default:                       return NULL;
   }
@@ -164,17 +531,61 @@ static const uint16_t EpiphanyArgRegs[] = {
 };
 static const unsigned NumArgRegs = llvm::array_lengthof(EpiphanyArgRegs);
 
+/// CC_Epiphany_Fast_SplitOnStack - The first half of a split 64-bit fastcc
+/// argument found no free register pair and is going on the stack. Take
+/// whatever argument register is still free so the second half follows it
+/// there, then return false to let the stack rule assign the slot.
+static bool CC_Epiphany_Fast_SplitOnStack(unsigned ValNo, MVT ValVT, MVT LocVT,
+                                          CCValAssign::LocInfo LocInfo,
+                                          ISD::ArgFlagsTy ArgFlags,
+                                          CCState &State) {
+  static const MCPhysReg FastArgRegs[] = {
+    Epiphany::R0, Epiphany::R1, Epiphany::R2, Epiphany::R3,
+    Epiphany::R4, Epiphany::R5, Epiphany::R6, Epiphany::R7,
+    Epiphany::R16, Epiphany::R17, Epiphany::R18, Epiphany::R19,
+    Epiphany::R20, Epiphany::R21, Epiphany::R22, Epiphany::R23
+  };
+  while (State.AllocateReg(FastArgRegs))
+    ;
+  return false;
+}
+
 #include "EpiphanyGenCallingConv.inc"
 
-CCAssignFn *EpiphanyTargetLowering::CCAssignFnForNode(CallingConv::ID CC) const {
+CCAssignFn *EpiphanyTargetLowering::CCAssignFnForNode(CallingConv::ID CC,
+                                                      bool IsVarArg) const {
 
   switch(CC) {
   default: llvm_unreachable("Unsupported calling convention");
+  case CallingConv::Fast:
+    return IsVarArg ? CC_A64_APCS : CC_Epiphany_Fast;
   case CallingConv::C:
     return CC_A64_APCS;
   }
 }
 
+CCAssignFn *EpiphanyTargetLowering::CCAssignFnForReturn(CallingConv::ID CC,
+                                                        bool IsVarArg) const {
+
+  switch(CC) {
+  default: llvm_unreachable("Unsupported calling convention");
+  case CallingConv::Fast:
+    return IsVarArg ? RetCC_A64_APCS : RetCC_Epiphany_Fast;
+  case CallingConv::C:
+    return RetCC_A64_APCS;
+  }
+}
+
+bool
+EpiphanyTargetLowering::CanLowerReturn(CallingConv::ID CallConv,
+                                       MachineFunction &MF, bool isVarArg,
+                                       const SmallVectorImpl<ISD::OutputArg> &Outs,
+                                       LLVMContext &Context) const {
+  SmallVector<CCValAssign, 16> RVLocs;
+  CCState CCInfo(CallConv, isVarArg, MF, RVLocs, Context);
+  return CCInfo.CheckReturn(Outs, CCAssignFnForReturn(CallConv, isVarArg));
+}
+
 void
 EpiphanyTargetLowering::SaveVarArgRegisters(CCState &CCInfo, SelectionDAG &DAG,
                                            SDLoc DL, SDValue &Chain) const {
@@ -233,7 +644,7 @@ EpiphanyTargetLowering::LowerFormalArguments(SDValue Chain,
 
   SmallVector<CCValAssign, 16> ArgLocs;
   CCState CCInfo(CallConv, isVarArg, DAG.getMachineFunction(), ArgLocs, *DAG.getContext());
-  CCInfo.AnalyzeFormalArguments(Ins, CCAssignFnForNode(CallConv));
+  CCInfo.AnalyzeFormalArguments(Ins, CCAssignFnForNode(CallConv, isVarArg));
 
   SmallVector<SDValue, 16> ArgValues;
 
@@ -298,6 +709,122 @@ EpiphanyTargetLowering::LowerFNEG(SDValue Op, SelectionDAG &DAG) const{
 	return DAG.getNode(ISD::BITCAST, dl, VT, Xor);
 }
 
+/// llvm.epiphany.dma.set.desc is just six word stores into the descriptor,
+/// which the ldrd/strd pass pairs up since descriptors are 8-byte aligned.
+/// Other intrinsics are left to the patterns.
+// A coreid call that lost its readnone attribute, e.g. one declared by hand,
+// arrives chained. The core ID never changes, so drop the chain and let it
+// select like the readnone form.
+SDValue
+EpiphanyTargetLowering::LowerINTRINSIC_W_CHAIN(SDValue Op,
+                                               SelectionDAG &DAG) const {
+  unsigned IntNo = cast<ConstantSDNode>(Op.getOperand(1))->getZExtValue();
+  if (IntNo != EpiphanyIntrinsic::epiphany_coreid)
+    return SDValue();
+
+  SDLoc dl(Op);
+  SDValue CoreID = DAG.getNode(ISD::INTRINSIC_WO_CHAIN, dl, MVT::i32,
+                               DAG.getConstant(IntNo, dl, MVT::i32));
+  return DAG.getMergeValues({ CoreID, Op.getOperand(0) }, dl);
+}
+
+SDValue
+EpiphanyTargetLowering::LowerINTRINSIC_VOID(SDValue Op,
+                                            SelectionDAG &DAG) const {
+  unsigned IntNo = cast<ConstantSDNode>(Op.getOperand(1))->getZExtValue();
+  if (IntNo != EpiphanyIntrinsic::epiphany_dma_set_desc)
+    return SDValue();
+
+  SDLoc dl(Op);
+  SDValue Chain = Op.getOperand(0);
+  SDValue Desc = Op.getOperand(2);
+  SDValue Config = Op.getOperand(3);
+  SDValue Next = Op.getOperand(4);
+
+  // Chaining: CHAINMODE (bit 2) and the next descriptor's local address in
+  // NEXT_PTR, the high half of the config word.
+  if (!isNullConstant(Next)) {
+    SDValue NextPtr = DAG.getNode(ISD::SHL, dl, MVT::i32, Next,
+                                  DAG.getConstant(16, dl, MVT::i32));
+    Config = DAG.getNode(ISD::OR, dl, MVT::i32, Config,
+                         DAG.getNode(ISD::OR, dl, MVT::i32, NextPtr,
+                                     DAG.getConstant(0x4, dl, MVT::i32)));
+  }
+
+  // config, inner stride, count, outer stride, source, destination.
+  SDValue Words[] = { Config, Op.getOperand(5), Op.getOperand(6),
+                      Op.getOperand(7), Op.getOperand(8), Op.getOperand(9) };
+  SDValue Stores[6];
+  for (unsigned i = 0; i != 6; ++i) {
+    SDValue Addr = DAG.getNode(ISD::ADD, dl, MVT::i32, Desc,
+                               DAG.getConstant(4 * i, dl, MVT::i32));
+    Stores[i] = DAG.getStore(Chain, dl, Words[i], Addr, MachinePointerInfo(),
+                             false, false, i % 2 ? 4 : 8);
+  }
+  return DAG.getNode(ISD::TokenFactor, dl, MVT::Other, Stores);
+}
+
+// There is no FPU divide or square root, so under unsafe-fp-math the DAG
+// combiner asks for an initial estimate here and refines it with Newton-Raphson
+// steps. Those are plain FMUL/FADD/FSUB, which are later fused into
+// fmadd/fmsub like any others. The estimates come from treating the float's
+// bit pattern as a rough log2 of its value; each refinement step roughly
+// doubles the number of correct bits. The step counts can be changed with
+// -recip=divf:N,sqrtf:N.
+
+SDValue
+EpiphanyTargetLowering::getRecipEstimate(SDValue Operand,
+                                         DAGCombinerInfo &DCI,
+                                         unsigned &RefinementSteps) const {
+  EVT VT = Operand.getValueType();
+  TargetRecip Recips = DCI.DAG.getTarget().Options.Reciprocals;
+  if (VT != MVT::f32 || !Recips.isEnabled("divf"))
+    return SDValue();
+
+  SelectionDAG &DAG = DCI.DAG;
+  SDLoc dl(Operand);
+
+  // 1/x ~= bits(0x7ef311c3 - bits(x)), good to about 4 bits.
+  SDValue Magic = DAG.getConstant(0x7ef311c3, dl, MVT::i32);
+  SDValue Bits = DAG.getNode(ISD::BITCAST, dl, MVT::i32, Operand);
+  SDValue Est = DAG.getNode(ISD::SUB, dl, MVT::i32, Magic, Bits);
+  DCI.AddToWorklist(Bits.getNode());
+  DCI.AddToWorklist(Est.getNode());
+
+  RefinementSteps = Recips.getRefinementSteps("divf");
+  return DAG.getNode(ISD::BITCAST, dl, VT, Est);
+}
+
+SDValue
+EpiphanyTargetLowering::getRsqrtEstimate(SDValue Operand,
+                                         DAGCombinerInfo &DCI,
+                                         unsigned &RefinementSteps,
+                                         bool &UseOneConstNR) const {
+  EVT VT = Operand.getValueType();
+  TargetRecip Recips = DCI.DAG.getTarget().Options.Reciprocals;
+  if (VT != MVT::f32 || !Recips.isEnabled("sqrtf"))
+    return SDValue();
+
+  SelectionDAG &DAG = DCI.DAG;
+  SDLoc dl(Operand);
+
+  // 1/sqrt(x) ~= bits(0x5f3759df - (bits(x) >> 1)), good to about 5 bits.
+  SDValue Magic = DAG.getConstant(0x5f3759df, dl, MVT::i32);
+  SDValue Bits = DAG.getNode(ISD::BITCAST, dl, MVT::i32, Operand);
+  SDValue Half = DAG.getNode(ISD::SRL, dl, MVT::i32, Bits,
+                             DAG.getConstant(1, dl, MVT::i32));
+  SDValue Est = DAG.getNode(ISD::SUB, dl, MVT::i32, Magic, Half);
+  DCI.AddToWorklist(Bits.getNode());
+  DCI.AddToWorklist(Half.getNode());
+  DCI.AddToWorklist(Est.getNode());
+
+  // est * (1.5 - 0.5 * x * est * est) needs one constant fewer than the
+  // two-constant form and maps onto a single fmsub per step.
+  UseOneConstNR = true;
+  RefinementSteps = Recips.getRefinementSteps("sqrtf");
+  return DAG.getNode(ISD::BITCAST, dl, VT, Est);
+}
+
 SDValue
 EpiphanyTargetLowering::LowerReturn(SDValue Chain,
                                    CallingConv::ID CallConv, bool isVarArg,
@@ -312,7 +839,7 @@ EpiphanyTargetLowering::LowerReturn(SDValue Chain,
                  RVLocs, *DAG.getContext());
 
   // Analyze outgoing return values.
-  CCInfo.AnalyzeReturn(Outs, CCAssignFnForNode(CallConv));
+  CCInfo.AnalyzeReturn(Outs, CCAssignFnForReturn(CallConv, isVarArg));
 
   SDValue Flag;
   SmallVector<SDValue, 4> RetOps(1, Chain);
@@ -392,17 +919,23 @@ EpiphanyTargetLowering::LowerCall(CallLoweringInfo &CLI, SmallVectorImpl<SDValue
 
 	if (IsTailCall) {
 		IsTailCall = IsEligibleForTailCallOptimization(Callee, CallConv, IsVarArg, IsStructRet, MF.getFunction()->hasStructRetAttr(), Outs, OutVals, Ins, DAG);
+		if (!IsTailCall && CLI.CS && CLI.CS->isMustTailCall())
+			report_fatal_error("failed to perform tail call elimination on a call "
+			                   "site marked musttail");
 	}
 
 	SmallVector<CCValAssign, 16> ArgLocs;
 	CCState CCInfo(CallConv, IsVarArg, DAG.getMachineFunction(), ArgLocs, *DAG.getContext());
-	CCInfo.AnalyzeCallOperands(Outs, CCAssignFnForNode(CallConv));
+	CCInfo.AnalyzeCallOperands(Outs, CCAssignFnForNode(CallConv, IsVarArg));
 
 	// On Epiphany (and all other architectures I'm aware of) the most this has to
 	// do is adjust the stack pointer.
 	unsigned NumBytes = RoundUpToAlignment(CCInfo.getNextStackOffset(), 4);
 
-	Chain = DAG.getCALLSEQ_START(Chain, DAG.getIntPtrConstant(NumBytes, dl, true), dl);
+	// A sibling call has no call frame of its own: its stack arguments go
+	// into our incoming argument area.
+	if (!IsTailCall)
+		Chain = DAG.getCALLSEQ_START(Chain, DAG.getIntPtrConstant(NumBytes, dl, true), dl);
 
 	SDValue StackPtr = DAG.getCopyFromReg(Chain, dl, Epiphany::SP, getPointerTy(DAG.getDataLayout()));
 
@@ -444,9 +977,21 @@ EpiphanyTargetLowering::LowerCall(CallLoweringInfo &CLI, SmallVectorImpl<SDValue
 
 		assert(VA.isMemLoc() && "unexpected argument location");
 
-		SDValue PtrOff = DAG.getIntPtrConstant(VA.getLocMemOffset(), dl);
-		SDValue DstAddr = DAG.getNode(ISD::ADD, dl, getPointerTy(DAG.getDataLayout()), StackPtr, PtrOff);
-		MachinePointerInfo DstInfo = MachinePointerInfo::getStack(VA.getLocMemOffset());
+		SDValue DstAddr;
+		MachinePointerInfo DstInfo;
+		if (IsTailCall) {
+			// The slot may still hold one of our own incoming arguments, so the
+			// store has to wait for anything that reads it.
+			unsigned OpSize = VA.getLocVT().getSizeInBits() / 8;
+			int FI = MF.getFrameInfo()->CreateFixedObject(OpSize, VA.getLocMemOffset(), true);
+			DstAddr = DAG.getFrameIndex(FI, getPointerTy(DAG.getDataLayout()));
+			DstInfo = MachinePointerInfo::getFixedStack(FI);
+			Chain = addTokenForArgument(Chain, DAG, MF.getFrameInfo(), FI);
+		} else {
+			SDValue PtrOff = DAG.getIntPtrConstant(VA.getLocMemOffset(), dl);
+			DstAddr = DAG.getNode(ISD::ADD, dl, getPointerTy(DAG.getDataLayout()), StackPtr, PtrOff);
+			DstInfo = MachinePointerInfo::getStack(VA.getLocMemOffset());
+		}
 
 
 		if (Flags.isByVal()) {
@@ -519,6 +1064,13 @@ EpiphanyTargetLowering::LowerCall(CallLoweringInfo &CLI, SmallVectorImpl<SDValue
 
 	SDVTList NodeTys = DAG.getVTList(MVT::Other, MVT::Glue);
 
+	// The epilogue is inserted in front of the TC_RETURN, which then becomes a
+	// plain branch to the callee.
+	if (IsTailCall) {
+		MF.getFrameInfo()->setHasTailCall();
+		return DAG.getNode(EpiphanyISD::TC_RETURN, dl, NodeTys, Ops);
+	}
+
 	Chain = DAG.getNode(EpiphanyISD::Call, dl, NodeTys, Ops);
 	InFlag = Chain.getValue(1);
 
@@ -546,7 +1098,7 @@ EpiphanyTargetLowering::LowerCallResult(SDValue Chain, SDValue InFlag,
   SmallVector<CCValAssign, 16> RVLocs;
   CCState CCInfo(CallConv, IsVarArg, DAG.getMachineFunction(),
                  RVLocs, *DAG.getContext());
-  CCInfo.AnalyzeCallResult(Ins, CCAssignFnForNode(CallConv));
+  CCInfo.AnalyzeCallResult(Ins, CCAssignFnForReturn(CallConv, IsVarArg));
 
   for (unsigned i = 0; i != RVLocs.size(); ++i) {
     CCValAssign VA = RVLocs[i];
@@ -582,6 +1134,56 @@ EpiphanyTargetLowering::LowerCallResult(SDValue Chain, SDValue InFlag,
 }
 
 
+bool EpiphanyTargetLowering::IsEligibleForTailCallOptimization(
+    SDValue Callee, CallingConv::ID CalleeCC, bool IsVarArg,
+    bool IsCalleeStructRet, bool IsCallerStructRet,
+    const SmallVectorImpl<ISD::OutputArg> &Outs,
+    const SmallVectorImpl<SDValue> &OutVals,
+    const SmallVectorImpl<ISD::InputArg> &Ins, SelectionDAG &DAG) const {
+  MachineFunction &MF = DAG.getMachineFunction();
+  const Function *CallerF = MF.getFunction();
+  const EpiphanyMachineFunctionInfo *FuncInfo =
+    MF.getInfo<EpiphanyMachineFunctionInfo>();
+
+  // Only sibling calls are done: the callee inherits our caller's return
+  // address and expectations, so it has to preserve the same registers and
+  // return its value in the same place. A variadic fastcc function follows the
+  // APCS for its arguments and results, so that has to match too.
+  if (CalleeCC != CallerF->getCallingConv())
+    return false;
+  if (CalleeCC == CallingConv::Fast && IsVarArg != CallerF->isVarArg())
+    return false;
+
+  // Our caller expects the sret pointer back in R0, which the callee doesn't
+  // know to do.
+  if (IsCalleeStructRet || IsCallerStructRet)
+    return false;
+
+  // Byval arguments would be copied into our incoming argument area, which
+  // could be where they're coming from; likewise our own byval arguments live
+  // there and could be passed by address.
+  for (unsigned i = 0, e = Outs.size(); i != e; ++i)
+    if (Outs[i].Flags.isByVal())
+      return false;
+  for (Function::const_arg_iterator A = CallerF->arg_begin(),
+         AE = CallerF->arg_end(); A != AE; ++A)
+    if (A->hasByValAttr())
+      return false;
+
+  // Stack arguments are stored over our own incoming ones, so they have to fit
+  // in that area. A variadic caller's va_list points into it as well.
+  SmallVector<CCValAssign, 16> ArgLocs;
+  CCState CCInfo(CalleeCC, IsVarArg, MF, ArgLocs, *DAG.getContext());
+  CCInfo.AnalyzeCallOperands(Outs, CCAssignFnForNode(CalleeCC, IsVarArg));
+  unsigned StackArgSize = CCInfo.getNextStackOffset();
+  if (StackArgSize > FuncInfo->getBytesInStackArgArea())
+    return false;
+  if (StackArgSize && CallerF->isVarArg())
+    return false;
+
+  return true;
+}
+
 SDValue EpiphanyTargetLowering::addTokenForArgument(SDValue Chain,
                                                    SelectionDAG &DAG,
                                                    MachineFrameInfo *MFI,
@@ -615,6 +1217,8 @@ SDValue EpiphanyTargetLowering::addTokenForArgument(SDValue Chain,
                       ArgChains);
 }
 
+/// IntCCToEpiphanyCC - Map an integer condition onto one of the conditions
+/// that test the IALU flags (NZCV).
 static EpiphanyCC::CondCodes IntCCToEpiphanyCC(ISD::CondCode CC) {
   switch (CC) {
   case ISD::SETEQ:  return EpiphanyCC::EQ;
@@ -631,6 +1235,53 @@ static EpiphanyCC::CondCodes IntCCToEpiphanyCC(ISD::CondCode CC) {
   }
 }
 
+/// getPostIndexedAddressParts - Fold "Op = add Ptr, Inc" into the memory
+/// access N when Inc is a multiple of the access size that fits the scaled
+/// 11-bit offset of the post-modify forms.
+bool EpiphanyTargetLowering::getPostIndexedAddressParts(SDNode *N, SDNode *Op,
+                                                        SDValue &Base,
+                                                        SDValue &Offset,
+                                                        ISD::MemIndexedMode &AM,
+                                                        SelectionDAG &DAG) const {
+  EVT VT;
+  SDValue Ptr;
+  if (LoadSDNode *LD = dyn_cast<LoadSDNode>(N)) {
+    // ldrb/ldrh zero extend, there is nothing to fold a sign extension into.
+    if (LD->getExtensionType() == ISD::SEXTLOAD)
+      return false;
+    VT = LD->getMemoryVT();
+    Ptr = LD->getBasePtr();
+  } else if (StoreSDNode *ST = dyn_cast<StoreSDNode>(N)) {
+    VT = ST->getMemoryVT();
+    Ptr = ST->getBasePtr();
+  } else
+    return false;
+
+  if (VT != MVT::i8 && VT != MVT::i16 && VT != MVT::i32 && VT != MVT::f32)
+    return false;
+
+  if (Op->getOpcode() != ISD::ADD && Op->getOpcode() != ISD::SUB)
+    return false;
+
+  ConstantSDNode *C = dyn_cast<ConstantSDNode>(Op->getOperand(1));
+  if (!C || Op->getOperand(0) != Ptr)
+    return false;
+
+  int64_t Inc = C->getSExtValue();
+  if (Op->getOpcode() == ISD::SUB)
+    Inc = -Inc;
+
+  // Same range as SelectOffsetUImm11.
+  int64_t MemSize = VT.getStoreSize();
+  if (Inc % MemSize != 0 || Inc / MemSize < -2047 || Inc / MemSize > 2047)
+    return false;
+
+  Base = Ptr;
+  Offset = DAG.getConstant(Inc, SDLoc(N), MVT::i32);
+  AM = ISD::POST_INC;
+  return true;
+}
+
 bool EpiphanyTargetLowering::isLegalICmpImmediate(int64_t Val) const {
   // icmp is implemented using adds/subs immediate with a 11bit signed imm
   // Symmetric by using adds/subs
@@ -641,6 +1292,43 @@ bool EpiphanyTargetLowering::isLegalICmpImmediate(int64_t Val) const {
   return (Val & ~0x3FF) == 0;
 }
 
+/// Loads and stores take a base register plus either an index register or
+/// an 11-bit displacement scaled by the access size.
+bool EpiphanyTargetLowering::isLegalAddressingMode(const DataLayout &DL,
+                                                   const AddrMode &AM, Type *Ty,
+                                                   unsigned AS) const {
+  // Symbols are built with mov/movt, never folded.
+  if (AM.BaseGV)
+    return false;
+
+  switch (AM.Scale) {
+  case 0:
+    break;
+  case 1:
+    // [Rn, Rm] has no room for a displacement as well.
+    if (AM.HasBaseReg && AM.BaseOffs)
+      return false;
+    break;
+  default:
+    return false;
+  }
+
+  if (AM.BaseOffs) {
+    int64_t Size = Ty->isSized() ? DL.getTypeStoreSize(Ty) : 1;
+    if (AM.BaseOffs % Size)
+      return false;
+    int64_t Disp = AM.BaseOffs / Size;
+    if (Disp < -2047 || Disp > 2047)
+      return false;
+  }
+  return true;
+}
+
+bool EpiphanyTargetLowering::isLegalAddImmediate(int64_t Val) const {
+  // add/sub take an 11-bit signed immediate, and +1024 becomes sub #-1024.
+  return Val >= -1024 && Val <= 1024;
+}
+
 SDValue EpiphanyTargetLowering::getSelectableIntSetCC(SDValue LHS, SDValue RHS,
                                         ISD::CondCode CC, SDValue &A64cc,
                                         SelectionDAG &DAG, SDLoc &dl) const {
@@ -703,6 +1391,9 @@ SDValue EpiphanyTargetLowering::getSelectableIntSetCC(SDValue LHS, SDValue RHS,
                      DAG.getCondCode(CC));
 }
 
+/// FPCCToEpiphanyCC - Map a floating-point condition onto one of the BEQ..BLTE
+/// conditions, which test the FPU flags (BFLAGS) set by FCMPss. There is no
+/// "greater than", so those set invert and the caller swaps the operands.
 static EpiphanyCC::CondCodes FPCCToEpiphanyCC(ISD::CondCode CC, bool& invert) {
 		EpiphanyCC::CondCodes CondCode = EpiphanyCC::Invalid;
 		invert = 0;
@@ -879,12 +1570,13 @@ EpiphanyTargetLowering::LowerJumpTable(SDValue Op, SelectionDAG &DAG) const {
   JumpTableSDNode *JT = cast<JumpTableSDNode>(Op);
   SDLoc dl = SDLoc(Op);
 
-  // When compiling PIC, jump tables get put in the code section so a static
-  // relocation-style is acceptable for both cases.
+  // Jump tables are always put in the code section (see
+  // EpiphanyLinuxTargetObjectFile), so a static relocation-style is acceptable
+  // for both cases. The AsmPrinter aligns them to their 4-byte entries.
   return DAG.getNode(EpiphanyISD::WrapperSmall, dl, getPointerTy(DAG.getDataLayout()),
                      DAG.getTargetJumpTable(JT->getIndex(), getPointerTy(DAG.getDataLayout()), EpiphanyII::MO_HI16),
                      DAG.getTargetJumpTable(JT->getIndex(), getPointerTy(DAG.getDataLayout()), EpiphanyII::MO_LO16),
-                     DAG.getConstant(1, dl, MVT::i32));
+                     DAG.getConstant(4, dl, MVT::i32));
 }
 
 // (SELECT_CC lhs, rhs, iftrue, iffalse, condcode)
@@ -987,6 +1679,8 @@ EpiphanyTargetLowering::LowerOperation(SDValue Op, SelectionDAG &DAG) const {
   case ISD::BRCOND: return LowerBRCOND(Op, DAG);
   case ISD::BR_CC: return LowerBR_CC(Op, DAG);
   case ISD::FNEG: return LowerFNEG(Op, DAG);
+  case ISD::INTRINSIC_W_CHAIN: return LowerINTRINSIC_W_CHAIN(Op, DAG);
+  case ISD::INTRINSIC_VOID: return LowerINTRINSIC_VOID(Op, DAG);
   case ISD::GlobalAddress: return LowerGlobalAddressELF(Op, DAG);
   case ISD::JumpTable: return LowerJumpTable(Op, DAG);
   case ISD::SELECT: return LowerSELECT(Op, DAG);
@@ -998,8 +1692,18 @@ EpiphanyTargetLowering::LowerOperation(SDValue Op, SelectionDAG &DAG) const {
 }
 
 
+/// Past -O0 the MachineCombiner forms fmadd/fmsub, where it can see latencies
+/// and reassociate accumulation chains first. Fusing here would hide the adds
+/// from it, so only the forms it can't match are left to the DAG.
+static bool leaveFMAToMachineCombiner(SelectionDAG &DAG,
+                                      const EpiphanySubtarget *Subtarget) {
+  return DAG.getTarget().getOptLevel() != CodeGenOpt::None &&
+         Subtarget->getInstrInfo()->useMachineCombiner();
+}
+
 SDValue
-PerformFSUBCombine(SDNode *N, TargetLowering::DAGCombinerInfo &DCI){
+PerformFSUBCombine(SDNode *N, TargetLowering::DAGCombinerInfo &DCI,
+                   const EpiphanySubtarget *Subtarget){
 
   SDValue N0 = N->getOperand(0);
   SDValue N1 = N->getOperand(1);
@@ -1007,34 +1711,34 @@ PerformFSUBCombine(SDNode *N, TargetLowering::DAGCombinerInfo &DCI){
   SDLoc dl = SDLoc(N);
   SelectionDAG &DAG = DCI.DAG;
 
-	// FSUB -> FMA combines:
-
-    // fold (fsub (fmul x, y), z) -> (fma z, x, y)
-    if (N0.getOpcode() == ISD::FMUL && N0->hasOneUse()) {
-		return DAG.getNode(EpiphanyISD::FM_A_S, dl, VT, N1, N0.getOperand(0), N0.getOperand(1), DAG.getConstant(1, dl, MVT::i32));
+	// FSUB -> FMA combines. FMSUB computes Rd = Rd - Rn * Rm, so a product as
+	// the minuend can't be folded without negating the result.
+
+    // fold (fsub (fneg (fmul x, y)), z) -> (fneg (fmadd z, x, y))
+    // The fneg is a single eor either way, and the MachineCombiner can't see
+    // through it once it has been lowered.
+    if (N0.getOpcode() == ISD::FNEG &&
+        N0.getOperand(0).getOpcode() == ISD::FMUL &&
+        N0->hasOneUse() && N0.getOperand(0).hasOneUse()) {
+      SDValue Mul = N0.getOperand(0);
+      SDValue Fma = DAG.getNode(EpiphanyISD::FM_A_S, dl, VT, N1, Mul.getOperand(0), Mul.getOperand(1), DAG.getConstant(0, dl, MVT::i32));
+      return DAG.getNode(ISD::FNEG, dl, VT, Fma);
     }
 
-    // fold (fsub x, (fmul y, z)) -> (fma x, y, z)
-    // Note: Commutes FSUB operands.
+    if (leaveFMAToMachineCombiner(DAG, Subtarget))
+      return SDValue();
+
+    // fold (fsub x, (fmul y, z)) -> (fmsub x, y, z)
     if (N1.getOpcode() == ISD::FMUL && N1->hasOneUse()) {
 		return DAG.getNode(EpiphanyISD::FM_A_S, dl, VT, N0, N1.getOperand(0), N1.getOperand(1), DAG.getConstant(1, dl, MVT::i32));
     }
 
-    // fold (fsub (-(fmul, x, y)), z) -> (fma (fneg x), y, (fneg z))
-    //if (N0.getOpcode() == ISD::FNEG && 
-    //    N0.getOperand(0).getOpcode() == ISD::FMUL &&
-    //    N0->hasOneUse() && N0.getOperand(0).hasOneUse()) {
-    //  SDValue N00 = N0.getOperand(0).getOperand(0);
-    //  SDValue N01 = N0.getOperand(0).getOperand(1);
-    //  return DAG.getNode(ISD::FMA, dl, VT,
-    //                     DAG.getNode(ISD::FNEG, dl, VT, N00), N01,
-    //                     DAG.getNode(ISD::FNEG, dl, VT, N1));
-    //}
   return SDValue();
 }
 
 SDValue
-PerformFADDCombine(SDNode *N, TargetLowering::DAGCombinerInfo &DCI){
+PerformFADDCombine(SDNode *N, TargetLowering::DAGCombinerInfo &DCI,
+                   const EpiphanySubtarget *Subtarget){
 
   SDValue N0 = N->getOperand(0);
   SDValue N1 = N->getOperand(1);
@@ -1042,6 +1746,9 @@ PerformFADDCombine(SDNode *N, TargetLowering::DAGCombinerInfo &DCI){
   SDLoc dl = SDLoc(N);
   SelectionDAG &DAG = DCI.DAG;
 
+	if (leaveFMAToMachineCombiner(DAG, Subtarget))
+		return SDValue();
+
 	// FADD -> FMA combines:
 	// fold (fadd (fmul x, y), z) -> (fma z, x, y)
 	if (N0.getOpcode() == ISD::FMUL && N0->hasOneUse()) {
@@ -1057,11 +1764,77 @@ PerformFADDCombine(SDNode *N, TargetLowering::DAGCombinerInfo &DCI){
 	return SDValue();
 }
 
+// Upper bound on the number of shifted terms summed in place of a __mulsi3
+// call.
+static const unsigned MaxMulShiftAddTerms = 4;
+
+// Returns true if a multiply by MulAmt is cheaper as shifts and adds than as
+// a libcall. Multiplies by 0, 1 and powers of two are left to the generic
+// combiner.
+static bool isShiftAddMulAmt(int64_t MulAmt) {
+	uint64_t Amt = MulAmt < 0 ? -(uint64_t)MulAmt : MulAmt;
+	if (Amt <= 1 || isPowerOf2_64(Amt))
+		return false;
+
+	// x * (2^n +/- 1) is a shift and an add/sub.
+	if (MulAmt > 0 && (isPowerOf2_64(Amt - 1) || isPowerOf2_64(Amt + 1)))
+		return true;
+
+	return countPopulation(Amt) <= MaxMulShiftAddTerms;
+}
+
+SDValue
+PerformMULCombine(SDNode *N, TargetLowering::DAGCombinerInfo &DCI,
+                  const EpiphanySubtarget *Subtarget){
+
+  EVT VT = N->getValueType(0);
+  if (VT != MVT::i32)
+    return SDValue();
+
+  ConstantSDNode *C = dyn_cast<ConstantSDNode>(N->getOperand(1));
+  if (!C)
+    return SDValue();
+
+  int64_t MulAmt = C->getSExtValue();
+  if (!isShiftAddMulAmt(MulAmt))
+    return SDValue();
+
+  SDValue X = N->getOperand(0);
+  SDLoc dl = SDLoc(N);
+  SelectionDAG &DAG = DCI.DAG;
+  uint64_t Amt = MulAmt < 0 ? -(uint64_t)MulAmt : MulAmt;
+  SDValue Res;
+
+	if (isPowerOf2_64(Amt - 1)) {
+		// x * (2^n + 1) -> (x << n) + x
+		SDValue Shl = DAG.getNode(ISD::SHL, dl, VT, X, DAG.getConstant(Log2_64(Amt - 1), dl, MVT::i32));
+		Res = DAG.getNode(ISD::ADD, dl, VT, Shl, X);
+	} else if (isPowerOf2_64(Amt + 1)) {
+		// x * (2^n - 1) -> (x << n) - x
+		SDValue Shl = DAG.getNode(ISD::SHL, dl, VT, X, DAG.getConstant(Log2_64(Amt + 1), dl, MVT::i32));
+		Res = DAG.getNode(ISD::SUB, dl, VT, Shl, X);
+	} else {
+		// Sum of (x << bit) for each set bit of the multiplier.
+		for (unsigned Bit = 0; Amt; ++Bit, Amt >>= 1) {
+			if (!(Amt & 1))
+				continue;
+			SDValue Term = Bit == 0 ? X : DAG.getNode(ISD::SHL, dl, VT, X, DAG.getConstant(Bit, dl, MVT::i32));
+			Res = Res.getNode() ? DAG.getNode(ISD::ADD, dl, VT, Res, Term) : Term;
+		}
+	}
+
+	if (MulAmt < 0)
+		Res = DAG.getNode(ISD::SUB, dl, VT, DAG.getConstant(0, dl, VT), Res);
+
+	return Res;
+}
+
 SDValue
 EpiphanyTargetLowering::PerformDAGCombine(SDNode *N, DAGCombinerInfo &DCI) const {
 		switch (N->getOpcode()) {
-		case ISD::FADD: return PerformFADDCombine(N, DCI);
-		case ISD::FSUB: return PerformFSUBCombine(N, DCI);
+		case ISD::FADD: return PerformFADDCombine(N, DCI, Subtarget);
+		case ISD::FSUB: return PerformFSUBCombine(N, DCI, Subtarget);
+		case ISD::MUL: return PerformMULCombine(N, DCI, Subtarget);
 		default: break;
 		}
 		return SDValue();
@@ -40,6 +40,10 @@ namespace EpiphanyISD {
     // procedure return. Will almost certainly be selected to "RET".
     Ret,
 
+    // A sibling call, selected to TCRETURNdi/TCRETURNri: a branch to the
+    // callee after our own epilogue.
+    TC_RETURN,
+
     /// This is an A64-ification of the standard LLVM SELECT_CC operation. The
     /// main difference is that it only has the values and an A64 condition,
     /// which will be produced by a setcc instruction.
@@ -62,7 +66,16 @@ namespace EpiphanyISD {
 	WrapperSmall,
 
 	// Node for FMA and FMS
-	FM_A_S
+	FM_A_S,
+
+    // Inline memcpy / memset loops, selected to MEMCPY_LOOP / MEMSET_LOOP and
+    // expanded by the custom inserter.
+    MEMCPY,
+    MEMSET,
+
+    // Program a DMA channel and start it; wait for a channel to go idle.
+    DMA_START,
+    DMA_WAIT
   };
 }
 
@@ -77,7 +90,17 @@ public:
 
   const char *getTargetNodeName(unsigned Opcode) const;
 
-  CCAssignFn *CCAssignFnForNode(CallingConv::ID CC) const;
+  /// Variadic functions always follow the APCS so that va_start knows where
+  /// to find the register arguments.
+  CCAssignFn *CCAssignFnForNode(CallingConv::ID CC, bool IsVarArg) const;
+  CCAssignFn *CCAssignFnForReturn(CallingConv::ID CC, bool IsVarArg) const;
+
+  /// Return values that don't fit in the return registers are demoted to an
+  /// sret argument.
+  bool CanLowerReturn(CallingConv::ID CallConv, MachineFunction &MF,
+                      bool isVarArg,
+                      const SmallVectorImpl<ISD::OutputArg> &Outs,
+                      LLVMContext &Context) const override;
 
   SDValue LowerFormalArguments(SDValue Chain,
                                CallingConv::ID CallConv, bool isVarArg,
@@ -115,16 +138,51 @@ public:
   SDValue LowerOperation(SDValue Op, SelectionDAG &DAG) const;
 
   bool isLegalICmpImmediate(int64_t Val) const;
+  bool isLegalAddImmediate(int64_t Val) const override;
+  bool isLegalAddressingMode(const DataLayout &DL, const AddrMode &AM,
+                             Type *Ty, unsigned AS) const override;
+
+  /// Every address space is a window onto the same 32-bit global address
+  /// map, so casts between them keep the bits.
+  bool isNoopAddrSpaceCast(unsigned SrcAS, unsigned DestAS) const override {
+    return true;
+  }
+
+  bool getPostIndexedAddressParts(SDNode *N, SDNode *Op, SDValue &Base,
+                                  SDValue &Offset, ISD::MemIndexedMode &AM,
+                                  SelectionDAG &DAG) const override;
   SDValue getSelectableIntSetCC(SDValue LHS, SDValue RHS, ISD::CondCode CC,
                          SDValue &A64cc, SelectionDAG &DAG, SDLoc &dl) const;
 
   virtual MachineBasicBlock *
   EmitInstrWithCustomInserter(MachineInstr *MI, MachineBasicBlock *MBB) const;
+  MachineBasicBlock *EmitMemOpLoop(MachineInstr *MI,
+                                   MachineBasicBlock *MBB) const;
+  MachineBasicBlock *EmitDMAStart(MachineInstr *MI,
+                                  MachineBasicBlock *MBB) const;
+  MachineBasicBlock *EmitDMAStartDesc(MachineInstr *MI,
+                                      MachineBasicBlock *MBB) const;
+  MachineBasicBlock *EmitDMAStatus(MachineInstr *MI,
+                                   MachineBasicBlock *MBB) const;
+  MachineBasicBlock *EmitDMAWait(MachineInstr *MI,
+                                 MachineBasicBlock *MBB) const;
+  MachineBasicBlock *EmitCTimerSet(MachineInstr *MI,
+                                   MachineBasicBlock *MBB) const;
+  MachineBasicBlock *EmitConfigUpdate(MachineInstr *MI,
+                                      MachineBasicBlock *MBB) const;
 
   SDValue LowerBlockAddress(SDValue Op, SelectionDAG &DAG) const;
   SDValue LowerBRCOND(SDValue Op, SelectionDAG &DAG) const;
   SDValue LowerBR_CC(SDValue Op, SelectionDAG &DAG) const;
   SDValue LowerFNEG(SDValue Op, SelectionDAG &DAG) const;
+  SDValue LowerINTRINSIC_W_CHAIN(SDValue Op, SelectionDAG &DAG) const;
+  SDValue LowerINTRINSIC_VOID(SDValue Op, SelectionDAG &DAG) const;
+
+  SDValue getRecipEstimate(SDValue Operand, DAGCombinerInfo &DCI,
+                           unsigned &RefinementSteps) const override;
+  SDValue getRsqrtEstimate(SDValue Operand, DAGCombinerInfo &DCI,
+                           unsigned &RefinementSteps,
+                           bool &UseOneConstNR) const override;
   SDValue LowerGlobalAddressELF(SDValue Op, SelectionDAG &DAG) const;
   SDValue LowerJumpTable(SDValue Op, SelectionDAG &DAG) const;
   SDValue LowerSELECT(SDValue Op, SelectionDAG &DAG) const;
@@ -133,7 +191,8 @@ public:
 
   virtual SDValue PerformDAGCombine(SDNode *N, DAGCombinerInfo &DCI) const;
 
-  //nope.
+  /// Whether the call can be done as a sibling call, reusing this function's
+  /// frame and incoming argument area.
   bool IsEligibleForTailCallOptimization(SDValue Callee,
                                     CallingConv::ID CalleeCC,
                                     bool IsVarArg,
@@ -142,7 +201,7 @@ public:
                                     const SmallVectorImpl<ISD::OutputArg> &Outs,
                                     const SmallVectorImpl<SDValue> &OutVals,
                                     const SmallVectorImpl<ISD::InputArg> &Ins,
-									SelectionDAG& DAG) const { return false;}
+                                    SelectionDAG& DAG) const;
 // custom fma due to fneg, so we say no
   virtual bool isFMAFasterThanMulAndAdd(EVT) const { return false; }
 
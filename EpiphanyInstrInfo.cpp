@@ -25,7 +25,9 @@
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Metadata.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/TargetRegistry.h"
 
 #include <algorithm>
@@ -35,6 +37,11 @@
 
 using namespace llvm;
 
+static cl::opt<bool>
+EnableMachineCombiner("epiphany-machine-combiner", cl::Hidden,
+                  cl::desc("Form fmadd/fmsub and reassociate FP chains in the MachineCombiner"),
+                  cl::init(true));
+
 EpiphanyInstrInfo::EpiphanyInstrInfo(const EpiphanySubtarget &STI)
   : EpiphanyGenInstrInfo(Epiphany::ADJCALLSTACKDOWN, Epiphany::ADJCALLSTACKUP),
     RI(*this, STI), Subtarget(STI) {}
@@ -47,6 +54,21 @@ void EpiphanyInstrInfo::copyPhysReg(MachineBasicBlock &MBB,
   bool GPRDest = Epiphany::GPR32RegClass.contains(DestReg);
   bool GPRSrc  = Epiphany::GPR32RegClass.contains(SrcReg);
 
+  // Register pairs are copied a half at a time. Pairs always start at an
+  // even register, so two different pairs never partly overlap.
+  if (Epiphany::DPR64RegClass.contains(DestReg, SrcReg)) {
+    const TargetRegisterInfo &TRI = getRegisterInfo();
+    unsigned DestLo = TRI.getSubReg(DestReg, Epiphany::sub_even);
+    unsigned DestHi = TRI.getSubReg(DestReg, Epiphany::sub_odd);
+    unsigned SrcLo = TRI.getSubReg(SrcReg, Epiphany::sub_even);
+    unsigned SrcHi = TRI.getSubReg(SrcReg, Epiphany::sub_odd);
+    BuildMI(MBB, I, DL, get(Epiphany::MOVww), DestLo)
+      .addReg(SrcLo, getKillRegState(KillSrc));
+    BuildMI(MBB, I, DL, get(Epiphany::MOVww), DestHi)
+      .addReg(SrcHi, getKillRegState(KillSrc));
+    return;
+  }
+
   if (GPRDest && GPRSrc) {
     BuildMI(MBB, I, DL, get(Epiphany::MOVww), DestReg)
 		.addReg(SrcReg, getKillRegState(KillSrc));
@@ -79,14 +101,14 @@ EpiphanyInstrInfo::analyzeCompare(const MachineInstr *MI, unsigned &SrcReg, unsi
   switch (MI->getOpcode()) {
   default: break;
   case Epiphany::SUBri_cmp:
-    SrcReg = MI->getOperand(0).getReg();
+    SrcReg = MI->getOperand(1).getReg();
     SrcReg2 = 0;
     CmpMask = ~0;
-    CmpValue = MI->getOperand(1).getImm();
+    CmpValue = MI->getOperand(2).getImm();
     return true;
   case Epiphany::CMPrr:
-    SrcReg = MI->getOperand(0).getReg();
-    SrcReg2 = MI->getOperand(1).getReg();
+    SrcReg = MI->getOperand(1).getReg();
+    SrcReg2 = MI->getOperand(2).getReg();
     CmpMask = ~0;
     CmpValue = 0;
     return true;
@@ -98,7 +120,8 @@ EpiphanyInstrInfo::analyzeCompare(const MachineInstr *MI, unsigned &SrcReg, unsi
 /// comparison into one that sets the zero bit in the flags register. Convert
 /// the SUBrr(r1,r2)|Subri(r1,CmpValue) instruction into one that sets the flags
 /// register and remove the CMPrr(r1,r2)|CMPrr(r2,r1)|CMPri(r1,CmpValue)
-/// instruction.
+/// instruction. Only the IALU flags (NZCV) are involved: FPU instructions
+/// write BFLAGS and may sit between the two without blocking the fold.
 bool
 EpiphanyInstrInfo::optimizeCompareInstr(MachineInstr *CmpInstr, unsigned SrcReg, unsigned SrcReg2, int CmpMask, int CmpValue, const MachineRegisterInfo *MRI) const {
 
@@ -124,7 +147,7 @@ EpiphanyInstrInfo::optimizeCompareInstr(MachineInstr *CmpInstr, unsigned SrcReg,
   MachineInstr *Sub = NULL;
   unsigned SrcReg2X = 0;
   if (CmpInstr->getOpcode() == Epiphany::CMPrr) {
-    SrcReg2X = CmpInstr->getOperand(1).getReg();
+    SrcReg2X = CmpInstr->getOperand(2).getReg();
     // MI is not a candidate for CMPrr.
     MI = NULL;
   } else if (MI->getParent() != CmpInstr->getParent() || CmpValue != 0) {
@@ -220,8 +243,12 @@ EpiphanyInstrInfo::optimizeCompareInstr(MachineInstr *CmpInstr, unsigned SrcReg,
 				break;
 			}
 			
+			// Only MOVCC/Bcc read NZCV; their _f forms read the FPU flags, which
+			// neither the compare nor the instruction replacing it touches.
 			EpiphanyCC::CondCodes CC;
 			switch(Instr.getOpcode()){
+			default:
+				return false;
 			case Epiphany::MOVCCrr:
 			case Epiphany::MOVCCss:
 				CC = (EpiphanyCC::CondCodes)Instr.getOperand(3).getImm();
@@ -300,7 +327,7 @@ EpiphanyInstrInfo::optimizeCompareInstr(MachineInstr *CmpInstr, unsigned SrcReg,
 /// Does the Opcode represent a conditional branch that we can remove and re-add
 /// at the end of a basic block?
 static bool isCondBranch(unsigned Opc) {
-  return Opc == Epiphany::Bcc;
+  return Opc == Epiphany::Bcc || Opc == Epiphany::Bcc_f;
 }
 
 /// Takes apart a given conditional branch MachineInstr (see isCondBranch),
@@ -312,6 +339,7 @@ static void classifyCondBranch(MachineInstr *I, MachineBasicBlock *&TBB,
                                SmallVectorImpl<MachineOperand> &Cond) {
   switch(I->getOpcode()) {
   case Epiphany::Bcc:
+  case Epiphany::Bcc_f:
     // These instructions just have one predicate operand in position 0 (either
     // a condition code or a register being compared).
     Cond.push_back(MachineOperand::CreateImm(I->getOpcode()));
@@ -387,13 +415,7 @@ EpiphanyInstrInfo::AnalyzeBranch(MachineBasicBlock &MBB,MachineBasicBlock *&TBB,
 
   // If the block ends with a B and a Bcc, handle it.
   if (LastOpc == Epiphany::Bimm) {
-    if (SecondLastOpc == Epiphany::Bcc) {
-      TBB =  SecondLastInst->getOperand(1).getMBB();
-      Cond.push_back(MachineOperand::CreateImm(Epiphany::Bcc));
-      Cond.push_back(SecondLastInst->getOperand(0));
-      FBB = LastInst->getOperand(0).getMBB();
-      return false;
-    } else if (isCondBranch(SecondLastOpc)) {
+    if (isCondBranch(SecondLastOpc)) {
       classifyCondBranch(SecondLastInst, TBB, Cond);
       FBB = LastInst->getOperand(0).getMBB();
       return false;
@@ -466,9 +488,88 @@ unsigned EpiphanyInstrInfo::RemoveBranch(MachineBasicBlock &MBB) const {
   return 2;
 }
 
+/// Can the flags be clobbered just before MI? Only the rest of the block is
+/// searched; flags still live at a block boundary count as live.
+static bool isNZCVDeadBefore(MachineBasicBlock::iterator MI,
+                             const TargetRegisterInfo *TRI) {
+  MachineBasicBlock &MBB = *MI->getParent();
+  for (MachineBasicBlock::iterator I = MI, E = MBB.end(); I != E; ++I) {
+    if (I->readsRegister(Epiphany::NZCV))
+      return false;
+    if (I->modifiesRegister(Epiphany::NZCV, TRI))
+      return true;
+  }
+  return MBB.succ_empty();
+}
+
+/// Build a 32-bit constant in DstReg. mov/movt always works and leaves the
+/// flags alone. When the flags are dead and DstReg is one of r0-r7, a
+/// shifted 16-bit value or a small negative number can instead be made with
+/// two instructions that EpiphanyCompress16 shrinks to 16 bits each.
+void EpiphanyInstrInfo::expandMOVi32imm(MachineBasicBlock &MBB,
+                                        MachineBasicBlock::iterator MI,
+                                        DebugLoc DL, unsigned DstReg,
+                                        uint32_t Val) const {
+  bool CanUseShort = Epiphany::GPR16RegClass.contains(DstReg) &&
+                     isNZCVDeadBefore(MI, &RI);
+
+  if (CanUseShort) {
+    int32_t SVal = static_cast<int32_t>(Val);
+    unsigned Shift = countTrailingZeros(Val);
+    if (SVal < 0 && SVal >= -1024) {
+      // mov Rd, #0; add Rd, Rd, #SVal
+      BuildMI(MBB, MI, DL, get(Epiphany::MOVri), DstReg).addImm(0);
+      BuildMI(MBB, MI, DL, get(Epiphany::ADDri), DstReg)
+        .addReg(DstReg, RegState::Kill)
+        .addImm(SVal)
+        ->addRegisterDead(Epiphany::NZCV, &RI);
+      return;
+    }
+    if (isUInt<8>(Val >> Shift)) {
+      // mov Rd, #(Val >> Shift); lsl Rd, Rd, #Shift
+      BuildMI(MBB, MI, DL, get(Epiphany::MOVri), DstReg).addImm(Val >> Shift);
+      BuildMI(MBB, MI, DL, get(Epiphany::LSLri), DstReg)
+        .addReg(DstReg, RegState::Kill)
+        .addImm(Shift)
+        ->addRegisterDead(Epiphany::NZCV, &RI);
+      return;
+    }
+  }
+
+  BuildMI(MBB, MI, DL, get(Epiphany::MOVri), DstReg).addImm(Val & 0xffff);
+  BuildMI(MBB, MI, DL, get(Epiphany::MOVTri), DstReg)
+    .addReg(DstReg, RegState::Kill)
+    .addImm(Val >> 16);
+}
+
 bool
 EpiphanyInstrInfo::expandPostRAPseudo(MachineBasicBlock::iterator MBBI) const {
-  return false;
+  MachineInstr &MI = *MBBI;
+  MachineBasicBlock &MBB = *MI.getParent();
+  DebugLoc DL = MI.getDebugLoc();
+  unsigned DstReg = MI.getOperand(0).getReg();
+
+  switch (MI.getOpcode()) {
+  default:
+    return false;
+  case Epiphany::MOVi32imm:
+    expandMOVi32imm(MBB, MBBI, DL, DstReg,
+                    static_cast<uint32_t>(MI.getOperand(1).getImm()));
+    break;
+  case Epiphany::MOVf32imm: {
+    // The FPU has no use for the short integer forms.
+    const ConstantFP *FPImm = MI.getOperand(1).getFPImm();
+    BuildMI(MBB, MBBI, DL, get(Epiphany::MOVri_nopat_f), DstReg)
+      .addFPImm(FPImm);
+    BuildMI(MBB, MBBI, DL, get(Epiphany::MOVTri_nopat_f), DstReg)
+      .addReg(DstReg, RegState::Kill)
+      .addFPImm(FPImm);
+    break;
+  }
+  }
+
+  MBB.erase(MBBI);
+  return true;
 }
 
 void
@@ -493,7 +594,7 @@ EpiphanyInstrInfo::storeRegToStackSlot(MachineBasicBlock &MBB,
   if (RC->hasType(MVT::i64) || RC->hasType(MVT::i32)) {
     switch(RC->getSize()) {
     case 4: StoreOp = Epiphany::LS32_STR; break;
-    //case 8: StoreOp = Epiphany::LS64_STR; break;
+    case 8: StoreOp = Epiphany::LSFP64_STR; break;
     default:
       llvm_unreachable("Unknown size for regclass");
     }
@@ -502,7 +603,7 @@ EpiphanyInstrInfo::storeRegToStackSlot(MachineBasicBlock &MBB,
            && "Expected integer or floating type for store");
     switch (RC->getSize()) {
     case 4: StoreOp = Epiphany::LSFP32_STR; break;
-    //case 8: StoreOp = Epiphany::LSFP64_STR; break;
+    case 8: StoreOp = Epiphany::LSFP64_STR; break;
     default:
       llvm_unreachable("Unknown size for regclass");
     }
@@ -537,7 +638,7 @@ EpiphanyInstrInfo::loadRegFromStackSlot(MachineBasicBlock &MBB,
   if (RC->hasType(MVT::i64) || RC->hasType(MVT::i32)) {
     switch(RC->getSize()) {
     case 4: LoadOp = Epiphany::LS32_LDR; break;
-    //case 8: LoadOp = Epiphany::LS64_LDR; break;
+    case 8: LoadOp = Epiphany::LSFP64_LDR; break;
     default:
       llvm_unreachable("Unknown size for regclass");
     }
@@ -546,7 +647,7 @@ EpiphanyInstrInfo::loadRegFromStackSlot(MachineBasicBlock &MBB,
            && "Expected integer or floating type for store");
     switch (RC->getSize()) {
     case 4: LoadOp = Epiphany::LSFP32_LDR; break;
-    //case 8: LoadOp = Epiphany::LSFP64_LDR; break;
+    case 8: LoadOp = Epiphany::LSFP64_LDR; break;
     default:
       llvm_unreachable("Unknown size for regclass");
     }
@@ -610,14 +711,49 @@ void EpiphanyInstrInfo::getAddressConstraints(const MachineInstr &MI,
     MinOffset = 0;
     MaxOffset = 0x7FF * AccessScale;
     return;
-  //case Epiphany::LSFP64_LDR: case Epiphany::LSFP64_STR:
-  //  AccessScale = 8;
-  //  MinOffset = 0;
-  //  MaxOffset = 0x7FF * AccessScale;
-  //  return;
+  case Epiphany::LSFP64_LDR: case Epiphany::LSFP64_STR:
+    AccessScale = 8;
+    MinOffset = 0;
+    MaxOffset = 0x7FF * AccessScale;
+    return;
   }
 }
 
+/// Load-to-use latencies for off-core memory: a few cycles per mesh hop each
+/// way for another core, plus the eLink crossing for external DRAM.
+static const int RemoteLoadLatency = 20;
+static const int ExternalLoadLatency = 60;
+
+unsigned EpiphanyInstrInfo::getAccessAddrSpace(const MachineInstr &MI) {
+  if (MI.memoperands_empty())
+    return EpiphanyAS::Generic;
+
+  unsigned AS = (*MI.memoperands_begin())->getAddrSpace();
+  for (MachineInstr::mmo_iterator I = MI.memoperands_begin(),
+         E = MI.memoperands_end(); I != E; ++I)
+    if ((*I)->getAddrSpace() != AS)
+      return EpiphanyAS::Generic;
+  return AS;
+}
+
+int EpiphanyInstrInfo::getOperandLatency(const InstrItineraryData *ItinData,
+                                         const MachineInstr *DefMI,
+                                         unsigned DefIdx,
+                                         const MachineInstr *UseMI,
+                                         unsigned UseIdx) const {
+  // Operand 0 is the loaded value; a post-increment's base comes back at
+  // the usual speed.
+  if (DefMI->mayLoad() && DefIdx == 0) {
+    switch (getAccessAddrSpace(*DefMI)) {
+    default: break;
+    case EpiphanyAS::Remote:   return RemoteLoadLatency;
+    case EpiphanyAS::External: return ExternalLoadLatency;
+    }
+  }
+  return TargetInstrInfo::getOperandLatency(ItinData, DefMI, DefIdx, UseMI,
+                                            UseIdx);
+}
+
 unsigned EpiphanyInstrInfo::getInstSizeInBytes(const MachineInstr &MI) const {
   const MCInstrDesc &MCID = MI.getDesc();
   const MachineBasicBlock &MBB = *MI.getParent();
@@ -641,6 +777,8 @@ unsigned EpiphanyInstrInfo::getInstSizeInBytes(const MachineInstr &MI) const {
   case TargetOpcode::CFI_INSTRUCTION:
   case TargetOpcode::EH_LABEL:
   case TargetOpcode::DBG_VALUE:
+  // The loop hardware branches back by itself; the end marker emits nothing.
+  case Epiphany::HWLOOP_END:
     return 0;
   default:
     llvm_unreachable("Unknown instruction class");
@@ -658,6 +796,202 @@ unsigned EpiphanyInstrInfo::getInstBundleLength(const MachineInstr &MI) const {
   return Size;
 }
 
+unsigned EpiphanyInstrInfo::getCompressedOpcode(unsigned Opc) const {
+  switch (Opc) {
+  default:                    return 0;
+  case Epiphany::ANDrr:       return Epiphany::ANDrr16;
+  case Epiphany::ORRrr:       return Epiphany::ORRrr16;
+  case Epiphany::EORrr:       return Epiphany::EORrr16;
+  case Epiphany::ADDrr:       return Epiphany::ADDrr16;
+  case Epiphany::SUBrr:
+  case Epiphany::CMPrr:       return Epiphany::SUBrr16;
+  case Epiphany::ADDri:       return Epiphany::ADDri16;
+  case Epiphany::SUBri:
+  case Epiphany::SUBri_cmp:   return Epiphany::SUBri16;
+  case Epiphany::LSLri:       return Epiphany::LSLri16;
+  case Epiphany::LSRri:       return Epiphany::LSRri16;
+  case Epiphany::ASRri:       return Epiphany::ASRri16;
+  case Epiphany::LSLrr:       return Epiphany::LSLrr16;
+  case Epiphany::LSRrr:       return Epiphany::LSRrr16;
+  case Epiphany::ASRrr:       return Epiphany::ASRrr16;
+  case Epiphany::FADD_ss:     return Epiphany::FADD16;
+  case Epiphany::FSUB_ss:
+  case Epiphany::FCMPss:      return Epiphany::FSUB16;
+  case Epiphany::FMUL_ss:     return Epiphany::FMUL16;
+  case Epiphany::FMADDsss:    return Epiphany::FMADD16;
+  case Epiphany::FMSUBsss:    return Epiphany::FMSUB16;
+  case Epiphany::FIXrs:       return Epiphany::FIX16;
+  case Epiphany::FLOATsr:     return Epiphany::FLOAT16;
+  case Epiphany::FABSss:      return Epiphany::FABS16;
+  case Epiphany::IMULrr:      return Epiphany::IMUL16;
+  case Epiphany::IMADDrrr:    return Epiphany::IMADD16;
+  case Epiphany::IMSUBrrr:    return Epiphany::IMSUB16;
+  case Epiphany::MOVri:
+  case Epiphany::MOVri_nopat: return Epiphany::MOVri16;
+  case Epiphany::MOVww:       return Epiphany::MOVww16;
+  case Epiphany::MOVss:       return Epiphany::MOVss16;
+  case Epiphany::LS8_LDR:     return Epiphany::LS8_LDR16;
+  case Epiphany::LS16_LDR:    return Epiphany::LS16_LDR16;
+  case Epiphany::LS32_LDR:    return Epiphany::LS32_LDR16;
+  case Epiphany::LSFP32_LDR:  return Epiphany::LSFP32_LDR16;
+  case Epiphany::LS8_STR:     return Epiphany::LS8_STR16;
+  case Epiphany::LS16_STR:    return Epiphany::LS16_STR16;
+  case Epiphany::LS32_STR:    return Epiphany::LS32_STR16;
+  case Epiphany::LSFP32_STR:  return Epiphany::LSFP32_STR16;
+  case Epiphany::LS8_RO_LDR:    return Epiphany::LS8_RO_LDR16;
+  case Epiphany::LS16_RO_LDR:   return Epiphany::LS16_RO_LDR16;
+  case Epiphany::LS32_RO_LDR:   return Epiphany::LS32_RO_LDR16;
+  case Epiphany::LSFP32_RO_LDR: return Epiphany::LSFP32_RO_LDR16;
+  case Epiphany::LS8_RO_STR:    return Epiphany::LS8_RO_STR16;
+  case Epiphany::LS16_RO_STR:   return Epiphany::LS16_RO_STR16;
+  case Epiphany::LS32_RO_STR:   return Epiphany::LS32_RO_STR16;
+  case Epiphany::LSFP32_RO_STR: return Epiphany::LSFP32_RO_STR16;
+  case Epiphany::JRx:         return Epiphany::JR16;
+  case Epiphany::JALRx:       return Epiphany::JALR16;
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// MachineCombiner
+//===----------------------------------------------------------------------===//
+
+bool EpiphanyInstrInfo::useMachineCombiner() const {
+  return EnableMachineCombiner;
+}
+
+/// Every FPU instruction writes BFLAGS. Rewriting one is only safe when
+/// nothing reads the flags it set.
+static bool hasDeadBFLAGS(const MachineInstr &MI) {
+  int Idx = MI.findRegisterDefOperandIdx(Epiphany::BFLAGS);
+  return Idx == -1 || MI.getOperand(Idx).isDead();
+}
+
+static void setDeadBFLAGS(MachineInstr &MI) {
+  if (MachineOperand *MO = MI.findRegisterDefOperand(Epiphany::BFLAGS))
+    MO->setIsDead();
+}
+
+bool
+EpiphanyInstrInfo::isAssociativeAndCommutative(const MachineInstr &Inst) const {
+  switch (Inst.getOpcode()) {
+  default:
+    return false;
+  case Epiphany::FADD_ss:
+  case Epiphany::FMUL_ss:
+    return Inst.getParent()->getParent()->getTarget().Options.UnsafeFPMath;
+  }
+}
+
+bool
+EpiphanyInstrInfo::hasReassociableOperands(const MachineInstr &Inst,
+                                           const MachineBasicBlock *MBB) const {
+  return hasDeadBFLAGS(Inst) &&
+         TargetInstrInfo::hasReassociableOperands(Inst, MBB);
+}
+
+void EpiphanyInstrInfo::setSpecialOperandAttr(MachineInstr &OldMI1,
+                                              MachineInstr &OldMI2,
+                                              MachineInstr &NewMI1,
+                                              MachineInstr &NewMI2) const {
+  // hasReassociableOperands only lets through instructions whose flags are
+  // dead, so the rebuilt ones are too.
+  setDeadBFLAGS(NewMI1);
+  setDeadBFLAGS(NewMI2);
+}
+
+/// Is MO a virtual register defined by an FMUL in MBB? The FMUL may have other
+/// users: fusing still takes its latency off this path, and the combiner's
+/// cost model decides whether that is worth the extra FPU op.
+static bool isCombinableFMUL(const MachineBasicBlock &MBB,
+                             const MachineOperand &MO) {
+  if (!MO.isReg() || !TargetRegisterInfo::isVirtualRegister(MO.getReg()))
+    return false;
+  const MachineRegisterInfo &MRI = MBB.getParent()->getRegInfo();
+  const MachineInstr *MI = MRI.getUniqueVRegDef(MO.getReg());
+  return MI && MI->getParent() == &MBB && MI->getOpcode() == Epiphany::FMUL_ss;
+}
+
+// MachineCombinerPattern is shared by all targets, so the multiply-add
+// patterns borrow the AArch64 names:
+//   MULADDW_OP1: fadd (fmul x, y), a  ->  fmadd a, x, y
+//   MULADDW_OP2: fadd a, (fmul x, y)  ->  fmadd a, x, y
+//   MULSUBW_OP2: fsub a, (fmul x, y)  ->  fmsub a, x, y
+// fmsub computes Ra - Rn * Rm, so a product as the minuend has no fused form.
+bool EpiphanyInstrInfo::getMachineCombinerPatterns(
+    MachineInstr &Root,
+    SmallVectorImpl<MachineCombinerPattern> &Patterns) const {
+  const MachineBasicBlock &MBB = *Root.getParent();
+
+  if (hasDeadBFLAGS(Root)) {
+    switch (Root.getOpcode()) {
+    default:
+      break;
+    case Epiphany::FADD_ss:
+      if (isCombinableFMUL(MBB, Root.getOperand(1)))
+        Patterns.push_back(MachineCombinerPattern::MULADDW_OP1);
+      if (isCombinableFMUL(MBB, Root.getOperand(2)))
+        Patterns.push_back(MachineCombinerPattern::MULADDW_OP2);
+      break;
+    case Epiphany::FSUB_ss:
+      if (isCombinableFMUL(MBB, Root.getOperand(2)))
+        Patterns.push_back(MachineCombinerPattern::MULSUBW_OP2);
+      break;
+    }
+  }
+
+  // Reassociation lets a long accumulation chain be split so several
+  // FMADDs can be in flight at once.
+  TargetInstrInfo::getMachineCombinerPatterns(Root, Patterns);
+  return !Patterns.empty();
+}
+
+void EpiphanyInstrInfo::genAlternativeCodeSequence(
+    MachineInstr &Root, MachineCombinerPattern Pattern,
+    SmallVectorImpl<MachineInstr *> &InsInstrs,
+    SmallVectorImpl<MachineInstr *> &DelInstrs,
+    DenseMap<unsigned, unsigned> &InstrIdxForVirtReg) const {
+  unsigned MulIdx, AccIdx, Opc;
+  switch (Pattern) {
+  default:
+    TargetInstrInfo::genAlternativeCodeSequence(Root, Pattern, InsInstrs,
+                                                DelInstrs, InstrIdxForVirtReg);
+    return;
+  case MachineCombinerPattern::MULADDW_OP1:
+    MulIdx = 1; AccIdx = 2; Opc = Epiphany::FMADDsss;
+    break;
+  case MachineCombinerPattern::MULADDW_OP2:
+    MulIdx = 2; AccIdx = 1; Opc = Epiphany::FMADDsss;
+    break;
+  case MachineCombinerPattern::MULSUBW_OP2:
+    MulIdx = 2; AccIdx = 1; Opc = Epiphany::FMSUBsss;
+    break;
+  }
+
+  MachineFunction &MF = *Root.getParent()->getParent();
+  MachineRegisterInfo &MRI = MF.getRegInfo();
+  MachineInstr *Mul = MRI.getUniqueVRegDef(Root.getOperand(MulIdx).getReg());
+  const MachineOperand &Acc = Root.getOperand(AccIdx);
+  const MachineOperand &X = Mul->getOperand(1);
+  const MachineOperand &Y = Mul->getOperand(2);
+
+  // The FMUL goes only if this was the last use of the product. Otherwise it
+  // stays where it is, and its operands are still live past it.
+  bool MulDies = MRI.hasOneNonDBGUse(Mul->getOperand(0).getReg()) &&
+                 hasDeadBFLAGS(*Mul);
+
+  MachineInstrBuilder MIB =
+    BuildMI(MF, Root.getDebugLoc(), get(Opc), Root.getOperand(0).getReg())
+      .addReg(Acc.getReg(), getKillRegState(Acc.isKill()))
+      .addReg(X.getReg(), getKillRegState(MulDies && X.isKill()))
+      .addReg(Y.getReg(), getKillRegState(MulDies && Y.isKill()));
+  setDeadBFLAGS(*MIB);
+
+  InsInstrs.push_back(MIB);
+  if (MulDies)
+    DelInstrs.push_back(Mul);
+  DelInstrs.push_back(&Root);
+}
+
 bool llvm::rewriteA64FrameIndex(MachineInstr &MI, unsigned FrameRegIdx,
                                 unsigned FrameReg, int &Offset,
                                 const EpiphanyInstrInfo &TII) {
@@ -687,6 +1021,7 @@ void llvm::EPIPHemitRegUpdate(MachineBasicBlock &MBB,
     Bits >>= 16;
     if (Bits & 0xffff) {
       BuildMI(MBB, MBBI, dl, TII.get(Epiphany::MOVTri), ScratchReg)
+        .addReg(ScratchReg)
         .addImm(0xffff & Bits).setMIFlags(MIFlags);
     }
 
@@ -696,7 +1031,6 @@ void llvm::EPIPHemitRegUpdate(MachineBasicBlock &MBB,
     BuildMI(MBB, MBBI, dl, TII.get(AddOp), DstReg)
       .addReg(SrcReg, RegState::Kill)
       .addReg(ScratchReg, RegState::Kill)
-      .addImm(0)
       .setMIFlag(MIFlags);
     return;
   }
@@ -741,6 +1075,6 @@ void llvm::EPIPHemitSPUpdate(MachineBasicBlock &MBB, MachineBasicBlock::iterator
                         DebugLoc dl, const TargetInstrInfo &TII,
                         unsigned ScratchReg, int64_t NumBytes,
                         MachineInstr::MIFlag MIFlags) {
-  EPIPHemitRegUpdate(MBB, MI, dl, TII, Epiphany::SP, Epiphany::SP, Epiphany::R63,
+  EPIPHemitRegUpdate(MBB, MI, dl, TII, Epiphany::SP, Epiphany::SP, ScratchReg,
                 NumBytes, MIFlags);
 }
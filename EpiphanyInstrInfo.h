@@ -79,6 +79,10 @@ public:
 
   bool expandPostRAPseudo(MachineBasicBlock::iterator MI) const;
 
+  /// Emit the cheapest sequence that puts Val in DstReg before MI.
+  void expandMOVi32imm(MachineBasicBlock &MBB, MachineBasicBlock::iterator MI,
+                       DebugLoc DL, unsigned DstReg, uint32_t Val) const;
+
   /// Look through the instructions in this function and work out the largest
   /// the stack frame can be while maintaining the ability to address local
   /// slots with no complexities.
@@ -95,8 +99,45 @@ public:
 
   unsigned getInstSizeInBytes(const MachineInstr &MI) const;
 
+  /// The address space a load or store touches, from its memory operands.
+  /// Generic when they are missing or disagree.
+  static unsigned getAccessAddrSpace(const MachineInstr &MI);
+
+  /// Loads from another core or external memory are mesh round trips, far
+  /// slower than the itineraries' local SRAM figure. Report that so the
+  /// scheduler starts them early.
+  int getOperandLatency(const InstrItineraryData *ItinData,
+                        const MachineInstr *DefMI, unsigned DefIdx,
+                        const MachineInstr *UseMI,
+                        unsigned UseIdx) const override;
+  using TargetInstrInfo::getOperandLatency;
+
+  /// getCompressedOpcode - Return the 16-bit form of a 32-bit opcode, or 0 if
+  /// it has none. The operands still have to be checked against the short
+  /// encoding (r0-r7, immediate range) before it can be used.
+  unsigned getCompressedOpcode(unsigned Opc) const;
+
   unsigned getInstBundleLength(const MachineInstr &MI) const;
 
+  /// MachineCombiner hooks. FADD/FSUB of an FMUL result become FMADD/FMSUB
+  /// when the scheduling model says the fused form shortens the critical
+  /// path, and under unsafe-fp-math FADD/FMUL chains are reassociated.
+  bool useMachineCombiner() const override;
+  bool isAssociativeAndCommutative(const MachineInstr &Inst) const override;
+  bool hasReassociableOperands(const MachineInstr &Inst,
+                               const MachineBasicBlock *MBB) const override;
+  void setSpecialOperandAttr(MachineInstr &OldMI1, MachineInstr &OldMI2,
+                             MachineInstr &NewMI1,
+                             MachineInstr &NewMI2) const override;
+  bool getMachineCombinerPatterns(
+      MachineInstr &Root,
+      SmallVectorImpl<MachineCombinerPattern> &Patterns) const override;
+  void genAlternativeCodeSequence(
+      MachineInstr &Root, MachineCombinerPattern Pattern,
+      SmallVectorImpl<MachineInstr *> &InsInstrs,
+      SmallVectorImpl<MachineInstr *> &DelInstrs,
+      DenseMap<unsigned, unsigned> &InstrIdxForVirtReg) const override;
+
 };
 
 bool rewriteA64FrameIndex(MachineInstr &MI, unsigned FrameRegIdx,
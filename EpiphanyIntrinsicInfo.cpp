@@ -0,0 +1,110 @@
+//===-- EpiphanyIntrinsicInfo.cpp - Epiphany Intrinsic Information ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains the implementation of the EpiphanyIntrinsicInfo class.
+//
+//===----------------------------------------------------------------------===//
+
+#include "EpiphanyIntrinsicInfo.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace llvm;
+
+EpiphanyIntrinsicInfo::EpiphanyIntrinsicInfo() : TargetIntrinsicInfo() {}
+
+std::string EpiphanyIntrinsicInfo::getName(unsigned IntrID, Type **Tys,
+                                           unsigned numTys) const {
+  static const char *const Names[] = {
+#define GET_INTRINSIC_NAME_TABLE
+#include "EpiphanyGenIntrinsics.inc"
+#undef GET_INTRINSIC_NAME_TABLE
+  };
+
+  if (IntrID < Intrinsic::num_intrinsics)
+    return std::string();
+  assert(IntrID < EpiphanyIntrinsic::num_epiphany_intrinsics &&
+         "Invalid intrinsic ID");
+
+  return Names[IntrID - Intrinsic::num_intrinsics];
+}
+
+unsigned EpiphanyIntrinsicInfo::lookupName(const char *Name,
+                                           unsigned Len) const {
+  if (!StringRef(Name, Len).startswith("llvm."))
+    return 0; // All intrinsics start with 'llvm.'
+
+#define GET_FUNCTION_RECOGNIZER
+#include "EpiphanyGenIntrinsics.inc"
+#undef GET_FUNCTION_RECOGNIZER
+  return 0;
+}
+
+bool EpiphanyIntrinsicInfo::isOverloaded(unsigned IntrID) const {
+  // None of the Epiphany intrinsics are overloaded.
+  return false;
+}
+
+Function *EpiphanyIntrinsicInfo::getDeclaration(Module *M, unsigned IntrID,
+                                                Type **Tys,
+                                                unsigned numTys) const {
+  LLVMContext &C = M->getContext();
+  Type *VoidTy = Type::getVoidTy(C);
+  Type *I32Ty = Type::getInt32Ty(C);
+  Type *PtrTy = Type::getInt8PtrTy(C);
+
+  FunctionType *FTy;
+  switch (IntrID) {
+  default:
+    llvm_unreachable("Invalid intrinsic ID");
+  case EpiphanyIntrinsic::epiphany_coreid:
+    FTy = FunctionType::get(I32Ty, false);
+    break;
+  case EpiphanyIntrinsic::epiphany_ctimer:
+    FTy = FunctionType::get(I32Ty, I32Ty, false);
+    break;
+  case EpiphanyIntrinsic::epiphany_ctimer_set:
+  case EpiphanyIntrinsic::epiphany_config_update: {
+    Type *Args[] = { I32Ty, I32Ty };
+    FTy = FunctionType::get(VoidTy, Args, false);
+    break;
+  }
+  case EpiphanyIntrinsic::epiphany_dma_set_desc: {
+    Type *Args[] = { PtrTy, I32Ty, PtrTy, I32Ty, I32Ty, I32Ty, PtrTy, PtrTy };
+    FTy = FunctionType::get(VoidTy, Args, false);
+    break;
+  }
+  case EpiphanyIntrinsic::epiphany_dma_start_desc: {
+    Type *Args[] = { I32Ty, PtrTy };
+    FTy = FunctionType::get(VoidTy, Args, false);
+    break;
+  }
+  case EpiphanyIntrinsic::epiphany_dma_start: {
+    Type *Args[] = { I32Ty, PtrTy, PtrTy, I32Ty, I32Ty, I32Ty };
+    FTy = FunctionType::get(VoidTy, Args, false);
+    break;
+  }
+  case EpiphanyIntrinsic::epiphany_dma_status:
+    FTy = FunctionType::get(I32Ty, I32Ty, false);
+    break;
+  case EpiphanyIntrinsic::epiphany_dma_wait:
+    FTy = FunctionType::get(VoidTy, I32Ty, false);
+    break;
+  }
+
+  Function *F = cast<Function>(M->getOrInsertFunction(getName(IntrID), FTy));
+  F->setDoesNotThrow();
+  // The core ID never changes. Calls without this still select, through
+  // LowerINTRINSIC_W_CHAIN, but can't be CSEd or hoisted.
+  if (IntrID == EpiphanyIntrinsic::epiphany_coreid)
+    F->setDoesNotAccessMemory();
+  return F;
+}
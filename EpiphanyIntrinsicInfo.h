@@ -0,0 +1,49 @@
+//===-- EpiphanyIntrinsicInfo.h - Epiphany Intrinsic Information -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the Epiphany subclass of TargetIntrinsicInfo, which
+// makes the intrinsics in EpiphanyIntrinsics.td known to the code generator.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EPIPHANYINTRINSICINFO_H
+#define LLVM_EPIPHANYINTRINSICINFO_H
+
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Target/TargetIntrinsicInfo.h"
+
+namespace llvm {
+
+namespace EpiphanyIntrinsic {
+enum ID {
+  last_non_epiphany_intrinsic = Intrinsic::num_intrinsics - 1,
+#define GET_INTRINSIC_ENUM_VALUES
+#include "EpiphanyGenIntrinsics.inc"
+#undef GET_INTRINSIC_ENUM_VALUES
+  , num_epiphany_intrinsics
+};
+} // end namespace EpiphanyIntrinsic
+
+// The generated recognizer names the enum after the intrinsics' TargetPrefix.
+namespace epiphanyIntrinsic = EpiphanyIntrinsic;
+
+class EpiphanyIntrinsicInfo : public TargetIntrinsicInfo {
+public:
+  EpiphanyIntrinsicInfo();
+  std::string getName(unsigned IntrID, Type **Tys = nullptr,
+                      unsigned numTys = 0) const override;
+  unsigned lookupName(const char *Name, unsigned Len) const override;
+  bool isOverloaded(unsigned IID) const override;
+  Function *getDeclaration(Module *M, unsigned ID, Type **Tys = nullptr,
+                           unsigned numTys = 0) const override;
+};
+
+}
+
+#endif
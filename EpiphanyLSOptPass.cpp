@@ -1,4 +1,4 @@
-//===-- EpiphanyLoadStoreOptimizer.cpp - Epiphany load / store opt. pass ------------===//
+//===-- EpiphanyLSOptPass.cpp - Epiphany load / store pairing ------------===//
 //
 //                     The LLVM Compiler Infrastructure
 //
@@ -7,8 +7,19 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file contains a pass that performs load / store related peephole
-// optimizations. This pass should be run after register allocation.
+// This file contains two passes that combine pairs of 32-bit loads / stores
+// to adjacent words into a single ldrd / strd.
+//
+// The pre-allocation pass works on virtual registers. It moves the second
+// access of a pair next to the first and defines both halves through a DPR64
+// register, so the allocator is free to pick an even / odd pair. It can raise
+// the alignment of stack objects to make a pair legal.
+//
+// The post-allocation pass catches what is left once registers and frame
+// offsets are known, e.g. spills and reloads that happen to land in an even /
+// odd pair of registers and an 8-byte aligned slot.
+//
+// Both use alias analysis to move accesses past unrelated memory operations.
 //
 //===----------------------------------------------------------------------===//
 
@@ -17,24 +28,29 @@
 #include "EpiphanyInstrInfo.h"
 #include "EpiphanyRegisterInfo.h"
 #include "EpiphanyMachineFunctionInfo.h"
+#include "Utils/EpiphanyBaseInfo.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstr.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
-#include "llvm/CodeGen/RegisterScavenging.h"
 #include "llvm/CodeGen/SelectionDAGNodes.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetInstrInfo.h"
 #include "llvm/Target/TargetMachine.h"
@@ -45,7 +61,45 @@ using namespace llvm;
 STATISTIC(NumLdStMoved, "Number of load / store instructions moved");
 STATISTIC(NumLDRDFormed,"Number of ldrd created before allocation");
 STATISTIC(NumSTRDFormed,"Number of strd created before allocation");
+STATISTIC(NumLDRDPostRA,"Number of ldrd created after allocation");
+STATISTIC(NumSTRDPostRA,"Number of strd created after allocation");
+
+/// How many instructions apart the two halves of a pair may start out. Moving
+/// an access further than this stretches live ranges for little gain.
+static const unsigned MaxPairDistance = 8;
 
+/// Stores to another core or external memory go out as one mesh packet each,
+/// and an strd carries twice the payload of an str. That is worth a longer
+/// live range.
+static const unsigned MaxOffCorePairDistance = 32;
+
+static bool isRegOffsetOp(unsigned Opc) {
+  switch (Opc) {
+  default:
+    return false;
+  case Epiphany::LS32_RO_LDR:
+  case Epiphany::LSFP32_RO_LDR:
+  case Epiphany::LS32_RO_STR:
+  case Epiphany::LSFP32_RO_STR:
+    return true;
+  }
+}
+
+/// The ldrd / strd that covers two of Opc, or 0 if Opc can't be paired. i32
+/// and f32 live in the same registers, so they pair with each other.
+static unsigned getPairedOpcode(unsigned Opc) {
+  switch (Opc) {
+  default:                       return 0;
+  case Epiphany::LS32_LDR:
+  case Epiphany::LSFP32_LDR:     return Epiphany::LSFP64_LDR;
+  case Epiphany::LS32_STR:
+  case Epiphany::LSFP32_STR:     return Epiphany::LSFP64_STR;
+  case Epiphany::LS32_RO_LDR:
+  case Epiphany::LSFP32_RO_LDR:  return Epiphany::LSFP64_RO_LDR;
+  case Epiphany::LS32_RO_STR:
+  case Epiphany::LSFP32_RO_STR:  return Epiphany::LSFP64_RO_STR;
+  }
+}
 
 /// isMemoryOp - Returns true if instruction is a memory operation that this
 /// pass is capable of operating on.
@@ -61,14 +115,12 @@ static bool isMemoryOp(const MachineInstr *MI) {
   if (MMO->isVolatile())
     return false;
 
-  // Unaligned ldr/str is emulated by some kernels, but unaligned ldm/stm is
-  // not.
+  // Misaligned words can't be part of an aligned doubleword.
   if (MMO->getAlignment() < 4)
     return false;
 
   // str <undef> could probably be eliminated entirely, but for now we just want
   // to avoid making a mess of it.
-  // FIXME: Use str <undef> as a wildcard to enable better stm folding.
   if (MI->getNumOperands() > 0 && MI->getOperand(0).isReg() &&
       MI->getOperand(0).isUndef())
     return false;
@@ -78,27 +130,134 @@ static bool isMemoryOp(const MachineInstr *MI) {
       MI->getOperand(1).isUndef())
     return false;
 
-  int Opcode = MI->getOpcode();
-  switch (Opcode) {
-  default: break;
-  case Epiphany::LS32_LDR:
-  case Epiphany::LSFP32_LDR:
-  case Epiphany::LS32_STR:
-  case Epiphany::LSFP32_STR:
-    return MI->getOperand(1).isReg();
+  // Before frame elimination, stack accesses at offset 0 take the frame
+  // index itself as their base.
+  unsigned Opc = MI->getOpcode();
+  if (!getPairedOpcode(Opc))
+    return false;
+  if (isRegOffsetOp(Opc))
+    return MI->getOperand(1).isReg() && MI->getOperand(2).isReg();
+  return MI->getOperand(1).isReg() || MI->getOperand(1).isFI();
+}
+
+namespace {
+  /// Where a load / store points: Base + Index + Offset bytes, or stack
+  /// object FrameIndex + Offset bytes if IsFrameIndex is set. Index is 0 for
+  /// the immediate forms. Two accesses can only be paired if they agree on
+  /// Base and Index, or on FrameIndex.
+  struct MemAddress {
+    unsigned Base;
+    unsigned Index;
+    int Offset;
+    int FrameIndex;
+    bool IsFrameIndex;
+  };
+
+  typedef std::pair<unsigned, unsigned> BaseIndex;
+}
+
+/// Decompose MI's address. Before allocation a register index defined by
+/// "add Rd, Rn, #imm" is looked through, so that [b, i] and [b, i + 4] are
+/// seen as neighbours. So is a base defined by "add Rb, fi, #imm", so that
+/// every access to one stack object shares a base. Without MRI, the address
+/// is exactly what MI's own operands say.
+static MemAddress getMemoryOpAddress(const MachineInstr *MI,
+                                     const MachineRegisterInfo *MRI) {
+  MemAddress Addr;
+  Addr.Base = 0;
+  Addr.Index = 0;
+  Addr.Offset = 0;
+  Addr.FrameIndex = 0;
+  Addr.IsFrameIndex = false;
+
+  const MachineOperand &BaseMO = MI->getOperand(1);
+  if (!isRegOffsetOp(MI->getOpcode())) {
+    unsigned NumOperands = MI->getDesc().getNumOperands();
+    int64_t Imm = MI->getOperand(NumOperands-1).getImm();
+    // A frame index keeps a byte offset until frame elimination scales it.
+    if (BaseMO.isFI()) {
+      Addr.FrameIndex = BaseMO.getIndex();
+      Addr.IsFrameIndex = true;
+      Addr.Offset = Imm;
+      return Addr;
+    }
+
+    Addr.Base = BaseMO.getReg();
+    Addr.Offset = Imm * 4;
+    if (MRI && TargetRegisterInfo::isVirtualRegister(Addr.Base)) {
+      const MachineInstr *Def = MRI->getUniqueVRegDef(Addr.Base);
+      if (Def && Def->getOpcode() == Epiphany::ADDri &&
+          Def->getOperand(1).isFI() && Def->getOperand(2).isImm()) {
+        Addr.Base = 0;
+        Addr.FrameIndex = Def->getOperand(1).getIndex();
+        Addr.IsFrameIndex = true;
+        Addr.Offset += Def->getOperand(2).getImm();
+      }
+    }
+    return Addr;
   }
-  return false;
+
+  Addr.Base = BaseMO.getReg();
+
+  Addr.Index = MI->getOperand(2).getReg();
+  if (MRI && TargetRegisterInfo::isVirtualRegister(Addr.Index)) {
+    const MachineInstr *Def = MRI->getUniqueVRegDef(Addr.Index);
+    if (Def && Def->getOpcode() == Epiphany::ADDri &&
+        Def->getOperand(1).isReg() && Def->getOperand(2).isImm()) {
+      Addr.Index = Def->getOperand(1).getReg();
+      Addr.Offset = Def->getOperand(2).getImm();
+    }
+  }
+  return Addr;
+}
+
+/// Accesses with the same key share a base. No register access has a zero
+/// base register, so a stack object is keyed by (0, its frame index).
+static BaseIndex getBaseKey(const MemAddress &Addr) {
+  if (Addr.IsFrameIndex)
+    return BaseIndex(0, static_cast<unsigned>(Addr.FrameIndex));
+  return BaseIndex(Addr.Base, Addr.Index);
+}
+
+/// Copy Op0 and Op1 operands into a new array assigned to MI.
+static void concatenateMemOperands(MachineInstr *MI, MachineInstr *Op0,
+                                   MachineInstr *Op1) {
+  assert(MI->memoperands_empty() && "expected a new machineinstr");
+  size_t numMemRefs = (Op0->memoperands_end() - Op0->memoperands_begin())
+    + (Op1->memoperands_end() - Op1->memoperands_begin());
+
+  MachineFunction *MF = MI->getParent()->getParent();
+  MachineSDNode::mmo_iterator MemBegin = MF->allocateMemRefsArray(numMemRefs);
+  MachineSDNode::mmo_iterator MemEnd =
+    std::copy(Op0->memoperands_begin(), Op0->memoperands_end(), MemBegin);
+  MemEnd =
+    std::copy(Op1->memoperands_begin(), Op1->memoperands_end(), MemEnd);
+  MI->setMemRefs(MemBegin, MemEnd);
 }
 
-static int getMemoryOpOffset(const MachineInstr *MI) {
-  //int Opcode = MI->getOpcode();
-  unsigned NumOperands = MI->getDesc().getNumOperands();
-  return MI->getOperand(NumOperands-1).getImm() * 4;//only 32bit
+/// Can the doubleword form of MI encode Offset? The immediate form takes a
+/// doubleword-scaled offset; the register form uses MI's own index register.
+static bool isLegalPairOffset(const MachineInstr *MI, int Offset) {
+  if (isRegOffsetOp(MI->getOpcode()))
+    return true;
+  return Offset % 8 == 0 && Offset / 8 >= -2047 && Offset / 8 <= 2047;
 }
 
-/// EpiphanyPreAllocLoadStoreOpt - Pre- register allocation pass that move
-/// load / stores from consecutive locations close to make it more
-/// likely they will be combined later.
+/// Do the memory operations I and Other have to stay in order? Only if one of
+/// them writes and they may overlap.
+static bool mayConflict(MachineInstr *I, MachineInstr *Other,
+                        AliasAnalysis *AA) {
+  if (!I->mayStore() && !Other->mayStore())
+    return false;
+  return I->mayAlias(AA, Other, /*UseTBAA*/ true);
+}
+
+//===----------------------------------------------------------------------===//
+// Before register allocation
+//===----------------------------------------------------------------------===//
+
+/// EpiphanyPreAllocLoadStoreOpt - Pre- register allocation pass that moves
+/// loads / stores from adjacent words next to each other and combines them.
 
 namespace {
   struct EpiphanyPreAllocLoadStoreOpt : public MachineFunctionPass{
@@ -109,22 +268,34 @@ namespace {
     const TargetInstrInfo *TII;
     const TargetRegisterInfo *TRI;
     MachineRegisterInfo *MRI;
+    MachineFrameInfo *MFI;
     MachineFunction *MF;
+    AliasAnalysis *AA;
 
-    virtual bool runOnMachineFunction(MachineFunction &Fn);
+    bool runOnMachineFunction(MachineFunction &Fn) override;
 
-    virtual const char *getPassName() const {
+    const char *getPassName() const override {
       return "Epiphany pre- register allocation load / store optimization pass";
     }
 
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<AAResultsWrapperPass>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
   private:
-    bool CanFormLdStDWord(MachineInstr *Op0, MachineInstr *Op1, DebugLoc &dl,
-                          unsigned &NewOpc, unsigned &EvenReg,
-                          unsigned &OddReg, unsigned &BaseReg,
-                          int &Offset);
+    bool isDWordAligned(MachineInstr *MI, const MemAddress &Addr,
+                        bool &NeedsRealign);
+    bool CanFormLdStDWord(MachineInstr *Op0, MachineInstr *Op1,
+                          const MemAddress &Addr, bool &NeedsRealign);
+    bool IsSafeAndProfitableToMove(bool isLd, MachineBasicBlock::iterator I,
+                                   MachineBasicBlock::iterator E,
+                                   MachineInstr *Op0, MachineInstr *Op1);
+    void FormLdStDWord(MachineBasicBlock *MBB, MachineInstr *Op0,
+                       MachineInstr *Op1, bool isLd,
+                       MachineBasicBlock::iterator InsertPos);
     bool RescheduleOps(MachineBasicBlock *MBB,
-                       SmallVector<MachineInstr*, 4> &Ops,
-                       unsigned Base, bool isLd,
+                       SmallVectorImpl<MachineInstr*> &Ops, bool isLd,
                        DenseMap<MachineInstr*, unsigned> &MI2LocMap);
     bool RescheduleLoadStoreInstrs(MachineBasicBlock *MBB);
   };
@@ -132,300 +303,246 @@ namespace {
 }
 
 bool EpiphanyPreAllocLoadStoreOpt::runOnMachineFunction(MachineFunction &Fn) {
-  TD  = Fn.getTarget().getDataLayout();
-  TII = MF->getSubtarget().getInstrInfo();
-  TRI = MF->getSubtarget().getRegisterInfo();
-  MRI = &Fn.getRegInfo();
   MF  = &Fn;
+  TD  = &Fn.getDataLayout();
+  TII = Fn.getSubtarget().getInstrInfo();
+  TRI = Fn.getSubtarget().getRegisterInfo();
+  MRI = &Fn.getRegInfo();
+  MFI = Fn.getFrameInfo();
+  AA  = &getAnalysis<AAResultsWrapperPass>().getAAResults();
 
   bool Modified = false;
   for (MachineFunction::iterator MFI = Fn.begin(), E = Fn.end(); MFI != E;
        ++MFI)
-    Modified |= RescheduleLoadStoreInstrs(MFI);
+    Modified |= RescheduleLoadStoreInstrs(&*MFI);
 
   return Modified;
 }
 
-static bool IsSafeAndProfitableToMove(bool isLd, unsigned Base,
-                                      MachineBasicBlock::iterator I,
-                                      MachineBasicBlock::iterator E,
-                                      SmallPtrSet<MachineInstr*, 4> &MemOps,
-                                      SmallSet<unsigned, 4> &MemRegs,
-                                      const TargetRegisterInfo *TRI) {
-  // Are there stores / loads / calls between them?
-  // FIXME: This is overly conservative. We should make use of alias information
-  // some day.
-  SmallSet<unsigned, 4> AddedRegPressure;
+/// Is the access MI, at Addr, known to be 8-byte aligned? The memory operand
+/// often understates it: a local object can still be realigned before frame
+/// layout, and globals are usually laid out with more alignment than their
+/// element type needs. NeedsRealign is set if it only will be once the stack
+/// object is realigned, which is left to the caller so that objects are only
+/// padded for pairs that are actually formed.
+bool EpiphanyPreAllocLoadStoreOpt::isDWordAligned(MachineInstr *MI,
+                                                  const MemAddress &Addr,
+                                                  bool &NeedsRealign) {
+  NeedsRealign = false;
+  const MachineMemOperand *MMO = *MI->memoperands_begin();
+  if (MMO->getAlignment() >= 8)
+    return true;
+
+  if (Addr.IsFrameIndex) {
+    int FI = Addr.FrameIndex;
+    if (Addr.Offset % 8 != 0)
+      return false;
+    if (MFI->getObjectAlignment(FI) >= 8)
+      return true;
+    if (MFI->isFixedObjectIndex(FI))
+      return false;
+    // The stack itself is 8-byte aligned, so this costs at most some padding.
+    NeedsRealign = true;
+    return true;
+  }
+
+  // Globals: the object's alignment and the constant offset into it.
+  const Value *V = MMO->getValue();
+  if (!V)
+    return false;
+  int64_t Offset = 0;
+  const Value *Obj = GetPointerBaseWithConstantOffset(V, Offset, *TD);
+  const GlobalVariable *GV = dyn_cast<GlobalVariable>(Obj);
+  if (!GV)
+    return false;
+
+  unsigned Align = GV->getAlignment();
+  if (!Align)
+    // Only a definition is sure to get more than the ABI alignment.
+    Align = GV->isDeclaration()
+              ? TD->getABITypeAlignment(GV->getType()->getElementType())
+              : TD->getPreferredAlignment(GV);
+  return MinAlign(Align, Offset + MMO->getOffset()) >= 8;
+}
+
+/// Op0 is the access at the lower address, Op1 the one 4 bytes above it.
+bool
+EpiphanyPreAllocLoadStoreOpt::CanFormLdStDWord(MachineInstr *Op0,
+                                               MachineInstr *Op1,
+                                               const MemAddress &Addr,
+                                               bool &NeedsRealign) {
+  // The pair is encoded like Op0, relative to its own base. A frame index
+  // offset is scaled and range checked by frame elimination.
+  MemAddress OwnAddr = getMemoryOpAddress(Op0, nullptr);
+  if (OwnAddr.IsFrameIndex ? OwnAddr.Offset % 8 != 0
+                           : !isLegalPairOffset(Op0, OwnAddr.Offset))
+    return false;
+
+  // Two loads into the same register can't both survive.
+  if (Op0->mayLoad() &&
+      Op0->getOperand(0).getReg() == Op1->getOperand(0).getReg())
+    return false;
+
+  return isDWordAligned(Op0, Addr, NeedsRealign);
+}
+
+/// Check that the half of the pair that moves can get past everything between
+/// I and E. Loads move up to the first access, stores down to the last.
+bool
+EpiphanyPreAllocLoadStoreOpt::IsSafeAndProfitableToMove(
+    bool isLd, MachineBasicBlock::iterator I,
+    MachineBasicBlock::iterator E, MachineInstr *Op0, MachineInstr *Op1) {
   while (++I != E) {
-    if (I->isDebugValue() || MemOps.count(&*I))
+    if (I->isDebugValue())
       continue;
     if (I->isCall() || I->isTerminator() || I->hasUnmodeledSideEffects())
       return false;
-    if (isLd && I->mayStore())
-      return false;
-    if (!isLd) {
-      if (I->mayLoad())
-        return false;
-      // It's not safe to move the first 'str' down.
-      // str r1, [r0]
-      // strh r5, [r0]
-      // str r4, [r0, #+4]
-      if (I->mayStore())
+    if (I->mayLoad() || I->mayStore()) {
+      // Loads only have to stay behind stores that might overlap them;
+      // stores have to stay ordered with every overlapping access.
+      if (isLd && !I->mayStore())
+        continue;
+      if (mayConflict(I, Op0, AA) || mayConflict(I, Op1, AA))
         return false;
     }
+    // The pair takes its address from Op0, which has to be available at
+    // the insertion point. With a register offset, a later Op0 may have
+    // computed its index in between.
     for (unsigned j = 0, NumOps = I->getNumOperands(); j != NumOps; ++j) {
       MachineOperand &MO = I->getOperand(j);
-      if (!MO.isReg())
+      if (!MO.isReg() || !MO.isDef())
         continue;
-      unsigned Reg = MO.getReg();
-      if (MO.isDef() && TRI->regsOverlap(Reg, Base))
-        return false;
-      if (Reg != Base && !MemRegs.count(Reg))
-        AddedRegPressure.insert(Reg);
+      for (unsigned k = 1, e = Op0->getDesc().getNumOperands(); k != e; ++k) {
+        const MachineOperand &AddrMO = Op0->getOperand(k);
+        if (AddrMO.isReg() && TRI->regsOverlap(MO.getReg(), AddrMO.getReg()))
+          return false;
+      }
     }
   }
+  return true;
+}
 
-  // Estimate register pressure increase due to the transformation.
-  if (MemRegs.size() <= 4)
-    // Ok if we are moving small number of instructions.
-    return true;
-  return AddedRegPressure.size() <= MemRegs.size() * 2;
+/// Address the pair MI like Op0, with the offset rescaled to doublewords. A
+/// frame index offset is still in bytes and stays as it is.
+static void setPairOffset(MachineInstr *MI, const MachineInstr *Op0) {
+  MemAddress Addr = getMemoryOpAddress(Op0, nullptr);
+  if (isRegOffsetOp(Op0->getOpcode()) || Addr.IsFrameIndex)
+    return;
+  MI->getOperand(2).setImm(Addr.Offset / 8);
 }
 
+/// Replace Op0 and Op1 with a single ldrd / strd at InsertPos. Op0 is the
+/// access at the lower address, which lives in the even half.
+void EpiphanyPreAllocLoadStoreOpt::FormLdStDWord(
+    MachineBasicBlock *MBB, MachineInstr *Op0, MachineInstr *Op1, bool isLd,
+    MachineBasicBlock::iterator InsertPos) {
+  const MCInstrDesc &MCID = TII->get(getPairedOpcode(Op0->getOpcode()));
+  const TargetRegisterClass *TRC = TII->getRegClass(MCID, 0, TRI, *MF);
+  unsigned DoubleReg = MRI->createVirtualRegister(TRC);
+  unsigned EvenReg = Op0->getOperand(0).getReg();
+  unsigned OddReg = Op1->getOperand(0).getReg();
+  DebugLoc dl = Op0->getDebugLoc();
+
+  // The pair is addressed like Op0, with the offset rescaled to doublewords.
+  if (isLd) {
+    MachineInstrBuilder MIB = BuildMI(*MBB, InsertPos, dl, MCID)
+      .addReg(DoubleReg, RegState::Define);
+    for (unsigned i = 1, e = Op0->getDesc().getNumOperands(); i != e; ++i)
+      MIB.addOperand(Op0->getOperand(i));
+    setPairOffset(MIB, Op0);
+    concatenateMemOperands(MIB, Op0, Op1);
+    DEBUG(dbgs() << "Formed " << *MIB << "\n");
+    ++NumLDRDFormed;
+
+    BuildMI(*MBB, InsertPos, dl, TII->get(TargetOpcode::COPY), EvenReg)
+      .addReg(DoubleReg, 0, Epiphany::sub_even);
+    BuildMI(*MBB, InsertPos, dl, TII->get(TargetOpcode::COPY), OddReg)
+      .addReg(DoubleReg, 0, Epiphany::sub_odd);
+  } else {
+    BuildMI(*MBB, InsertPos, dl, TII->get(TargetOpcode::REG_SEQUENCE),
+            DoubleReg)
+      .addReg(EvenReg)
+      .addImm(Epiphany::sub_even)
+      .addReg(OddReg)
+      .addImm(Epiphany::sub_odd);
+
+    MachineInstrBuilder MIB = BuildMI(*MBB, InsertPos, dl, MCID)
+      .addReg(DoubleReg, RegState::Kill);
+    for (unsigned i = 1, e = Op0->getDesc().getNumOperands(); i != e; ++i)
+      MIB.addOperand(Op0->getOperand(i));
+    setPairOffset(MIB, Op0);
+    concatenateMemOperands(MIB, Op0, Op1);
+    DEBUG(dbgs() << "Formed " << *MIB << "\n");
+    ++NumSTRDFormed;
+
+    MRI->clearKillFlags(EvenReg);
+    MRI->clearKillFlags(OddReg);
+  }
 
-/// Copy Op0 and Op1 operands into a new array assigned to MI.
-static void concatenateMemOperands(MachineInstr *MI, MachineInstr *Op0,
-                                   MachineInstr *Op1) {
-  assert(MI->memoperands_empty() && "expected a new machineinstr");
-  size_t numMemRefs = (Op0->memoperands_end() - Op0->memoperands_begin())
-    + (Op1->memoperands_end() - Op1->memoperands_begin());
+  // One of the accesses moved, so kills of the address may now be early.
+  for (unsigned i = 1, e = Op0->getDesc().getNumOperands(); i != e; ++i)
+    if (Op0->getOperand(i).isReg())
+      MRI->clearKillFlags(Op0->getOperand(i).getReg());
 
-  MachineFunction *MF = MI->getParent()->getParent();
-  MachineSDNode::mmo_iterator MemBegin = MF->allocateMemRefsArray(numMemRefs);
-  MachineSDNode::mmo_iterator MemEnd =
-    std::copy(Op0->memoperands_begin(), Op0->memoperands_end(), MemBegin);
-  MemEnd =
-    std::copy(Op1->memoperands_begin(), Op1->memoperands_end(), MemEnd);
-  MI->setMemRefs(MemBegin, MemEnd);
+  Op0->eraseFromParent();
+  Op1->eraseFromParent();
 }
 
-bool
-EpiphanyPreAllocLoadStoreOpt::CanFormLdStDWord(MachineInstr *Op0, MachineInstr *Op1,
-                                          DebugLoc &dl,
-                                          unsigned &NewOpc, unsigned &EvenReg,
-                                          unsigned &OddReg, unsigned &BaseReg,
-                                          int &Offset) {
- 
-  //unsigned Opcode = Op0->getOpcode();
-  switch(Op0->getOpcode()){
-	case Epiphany::LS32_LDR:
-	case Epiphany::LSFP32_LDR: NewOpc = Epiphany::LSFP64_LDR;break;
-	case Epiphany::LSFP32_STR:
-	case Epiphany::LS32_STR: NewOpc = Epiphany::LSFP64_STR;break;
-	default: return false;
-  }
-
-  // Make sure the base address satisfies i64 ld / st alignment requirement.
-  if (!Op0->hasOneMemOperand() || !(*Op0->memoperands_begin())->getValue() || (*Op0->memoperands_begin())->isVolatile())
-    return false;
+bool EpiphanyPreAllocLoadStoreOpt::RescheduleOps(MachineBasicBlock *MBB,
+    SmallVectorImpl<MachineInstr*> &Ops, bool isLd,
+    DenseMap<MachineInstr*, unsigned> &MI2LocMap) {
+  bool RetVal = false;
 
-  unsigned Align = (*Op0->memoperands_begin())->getAlignment();
-  //const Function *Func = MF->getFunction();
-  if (Align < 8)
-    return false;
+  // Sort by offset. All of Ops share the same base and index.
+  DenseMap<MachineInstr*, int> Offsets;
+  for (unsigned i = 0, e = Ops.size(); i != e; ++i)
+    Offsets[Ops[i]] = getMemoryOpAddress(Ops[i], MRI).Offset;
+  std::sort(Ops.begin(), Ops.end(),
+            [&](MachineInstr *LHS, MachineInstr *RHS) {
+              assert(LHS == RHS || Offsets[LHS] != Offsets[RHS]);
+              return Offsets[LHS] < Offsets[RHS];
+            });
+
+  for (unsigned i = 0; i + 1 < Ops.size(); ++i) {
+    MachineInstr *Op0 = Ops[i];
+    MachineInstr *Op1 = Ops[i+1];
+    if (Offsets[Op1] != Offsets[Op0] + 4)
+      continue;
 
-  // Then make sure the immediate offset fits.
-  Offset = getMemoryOpOffset(Op0);
+    MemAddress Addr = getMemoryOpAddress(Op0, MRI);
+    bool NeedsRealign;
+    if (!CanFormLdStDWord(Op0, Op1, Addr, NeedsRealign))
+      continue;
 
-  EvenReg = Op0->getOperand(0).getReg();
-  OddReg  = Op1->getOperand(0).getReg();
-  if (EvenReg == OddReg)
-    return false;
-  BaseReg = Op0->getOperand(1).getReg();
-  dl = Op0->getDebugLoc();
-  return true;
-}
+    // Be conservative, if the instructions are too far apart, don't
+    // move them. We want to limit the increase of register pressure.
+    MachineInstr *FirstOp = Op0, *LastOp = Op1;
+    if (MI2LocMap[FirstOp] > MI2LocMap[LastOp])
+      std::swap(FirstOp, LastOp);
+    unsigned MaxDistance = MaxPairDistance;
+    if (!isLd &&
+        EpiphanyAS::isOffCore(EpiphanyInstrInfo::getAccessAddrSpace(*Op0)))
+      MaxDistance = MaxOffCorePairDistance;
+    if (MI2LocMap[LastOp] - MI2LocMap[FirstOp] > MaxDistance)
+      continue;
+    if (!IsSafeAndProfitableToMove(isLd, FirstOp, LastOp, Op0, Op1))
+      continue;
 
-namespace {
-  struct OffsetCompare {
-    bool operator()(const MachineInstr *LHS, const MachineInstr *RHS) const {
-      int LOffset = getMemoryOpOffset(LHS);
-      int ROffset = getMemoryOpOffset(RHS);
-      assert(LHS == RHS || LOffset != ROffset);
-      return LOffset > ROffset;
+    // Loads are issued as early as the first of them, stores wait until
+    // both values are ready.
+    if (NeedsRealign) {
+      DEBUG(dbgs() << "Realigning fi#" << Addr.FrameIndex << " for " << *Op0);
+      MFI->setObjectAlignment(Addr.FrameIndex, 8);
     }
-  };
-}
 
-bool EpiphanyPreAllocLoadStoreOpt::RescheduleOps(MachineBasicBlock *MBB,
-	SmallVector<MachineInstr*, 4> &Ops,
-	unsigned Base, bool isLd,
-	DenseMap<MachineInstr*, unsigned> &MI2LocMap) {
-		bool RetVal = false;
-
-		// Sort by offset (in reverse order).
-		std::sort(Ops.begin(), Ops.end(), OffsetCompare());
-
-		// The loads / stores of the same base are in order. Scan them from first to
-		// last and check for the following:
-		// 1. Any def of base.
-		// 2. Any gaps.
-		while (Ops.size() > 1) {
-			unsigned FirstLoc = ~0U;
-			unsigned LastLoc = 0;
-			MachineInstr *FirstOp = 0;
-			MachineInstr *LastOp = 0;
-			int LastOffset = 0;
-			//unsigned LastOpcode = 0;
-			unsigned LastBytes = 0;
-			unsigned NumMove = 0;
-			for (int i = Ops.size() - 1; i >= 0; --i) {
-				MachineInstr *Op = Ops[i];
-				unsigned Loc = MI2LocMap[Op];
-				if (Loc <= FirstLoc) {
-					FirstLoc = Loc;
-					FirstOp = Op;
-				}
-				if (Loc >= LastLoc) {
-					LastLoc = Loc;
-					LastOp = Op;
-				}
-
-				//unsigned LSMOpcode = 0;//getLoadStoreMultipleOpcode(Op->getOpcode(), Epiphany_AM::ia);
-				//if (LastOpcode && LSMOpcode != LastOpcode)
-				//  break;
-
-				int Offset = getMemoryOpOffset(Op);
-				unsigned Bytes = 4;//getLSMultipleTransferSize(Op);
-				if (LastBytes) {
-					if (Bytes != LastBytes || Offset != (LastOffset + (int)Bytes))
-						break;
-				}
-				LastOffset = Offset;
-				LastBytes = Bytes;
-				//LastOpcode = LSMOpcode;
-				if (++NumMove == 8) // FIXME: Tune this limit.
-					break;
-			}
-
-			if (NumMove <= 1)
-				Ops.pop_back();
-			else {
-				SmallPtrSet<MachineInstr*, 4> MemOps;
-				SmallSet<unsigned, 4> MemRegs;
-				for (int i = NumMove-1; i >= 0; --i) {
-					MemOps.insert(Ops[i]);
-					MemRegs.insert(Ops[i]->getOperand(0).getReg());
-				}
-
-				// Be conservative, if the instructions are too far apart, don't
-				// move them. We want to limit the increase of register pressure.
-				bool DoMove = (LastLoc - FirstLoc) <= NumMove*4; // FIXME: Tune this.
-				if (DoMove)
-					DoMove = IsSafeAndProfitableToMove(isLd, Base, FirstOp, LastOp,
-					MemOps, MemRegs, TRI);
-				if (!DoMove) {
-					for (unsigned i = 0; i != NumMove; ++i)
-						Ops.pop_back();
-				} else {
-					// This is the new location for the loads / stores.
-					MachineBasicBlock::iterator InsertPos = isLd ? FirstOp : LastOp;
-					while (InsertPos != MBB->end() && (MemOps.count(InsertPos) || InsertPos->isDebugValue()))
-						++InsertPos;
-
-					// If we are moving a pair of loads / stores, see if it makes sense
-					// to try to allocate a pair of registers that can form register pairs.
-					MachineInstr *Op0 = Ops.back();
-					MachineInstr *Op1 = Ops[Ops.size()-2];
-					unsigned EvenReg = 0, OddReg = 0;
-					unsigned BaseReg = 0, DoubleReg = 0;
-					//bool isT2 = false;
-					unsigned NewOpc = 0;
-					int Offset = 0;
-					DebugLoc dl;
-					if (NumMove == 2 && CanFormLdStDWord(Op0, Op1, dl, NewOpc,
-						EvenReg, OddReg, BaseReg,
-						Offset)) {
-							Ops.pop_back();
-							Ops.pop_back();
-
-							const MCInstrDesc &MCID = TII->get(NewOpc);
-							const TargetRegisterClass *TRC = TII->getRegClass(MCID, 0, TRI, *MF);
-							DoubleReg = MRI->createVirtualRegister(TRC);
-
-
-							// Form the pair instruction.
-							if (isLd) {
-								MachineInstrBuilder MIB = BuildMI(*MBB, InsertPos, dl, MCID)
-									.addReg(DoubleReg, RegState::Define)
-									.addReg(BaseReg);
-								MIB.addImm(Offset);
-								concatenateMemOperands(MIB, Op0, Op1);
-								DEBUG(dbgs() << "Formed " << *MIB << "\n");
-								++NumLDRDFormed;
-
-								//FIXME: i think this is kinda bad, use EXTRACT_SUBREG instead?
-
-								// Collect all the uses of this MI's DPR def for updating later.
-								SmallVector<MachineOperand*, 8> Uses0,Uses1;
-
-								//for (MachineRegisterInfo::use_iterator I = MRI->use_begin(Op0->getOperand(0).getReg()),E = MRI->use_end(); I != E; ++I)
-								//	Uses0.push_back(&I.getOperand());
-
-								//for (MachineRegisterInfo::use_iterator I = MRI->use_begin(Op1->getOperand(0).getReg()),E = MRI->use_end(); I != E; ++I)
-								//	Uses1.push_back(&I.getOperand());
-
-
-								BuildMI(*MBB, InsertPos, dl, TII->get(Epiphany::COPY))
-									.addReg(Op0->getOperand(0).getReg(), RegState::Define)
-									.addReg(DoubleReg, 0, Epiphany::sub_odd);
-								BuildMI(*MBB, InsertPos, dl, TII->get(Epiphany::COPY))
-									.addReg(Op1->getOperand(0).getReg(), RegState::Define)
-									.addReg(DoubleReg, 0, Epiphany::sub_even);
-
-								//for (SmallVector<MachineOperand*, 8>::const_iterator I = Uses0.begin(), E = Uses0.end(); I != E; ++I)
-								//	(*I)->substVirtReg(DoubleReg, Epiphany::sub_even, *TRI);
-
-								//for (SmallVector<MachineOperand*, 8>::const_iterator I = Uses1.begin(), E = Uses1.end(); I != E; ++I)
-								//	(*I)->substVirtReg(DoubleReg, Epiphany::sub_odd, *TRI);
-
-							} else {//store
-
-								//build our dpr
-								BuildMI(*MBB, InsertPos, dl, TII->get(Epiphany::REG_SEQUENCE), DoubleReg)
-									.addReg(Op0->getOperand(0).getReg())
-									.addImm(Epiphany::sub_even)
-									.addReg(Op1->getOperand(0).getReg())
-									.addImm(Epiphany::sub_odd);
-
-
-								MachineInstrBuilder MIB = BuildMI(*MBB, InsertPos, dl, MCID)
-									.addReg(DoubleReg, RegState::Kill)
-									.addReg(BaseReg);
-								MIB.addImm(Offset);
-								concatenateMemOperands(MIB, Op0, Op1);
-								DEBUG(dbgs() << "Formed " << *MIB << "\n");
-								++NumSTRDFormed;
-
-							}
-							MBB->erase(Op0);
-							MBB->erase(Op1);
-
-					} else {
-						for (unsigned i = 0; i != NumMove; ++i) {
-							MachineInstr *Op = Ops.back();
-							Ops.pop_back();
-							MBB->splice(InsertPos, MBB, Op);
-						}
-					}
-
-					NumLdStMoved += NumMove;
-					RetVal = true;
-				}
-			}
-		}
-
-		return RetVal;
+    MachineBasicBlock::iterator InsertPos = isLd ? FirstOp : LastOp;
+    FormLdStDWord(MBB, Op0, Op1, isLd, InsertPos);
+    NumLdStMoved += 2;
+    RetVal = true;
+    ++i;
+  }
+
+  return RetVal;
 }
 
 bool
@@ -433,10 +550,10 @@ EpiphanyPreAllocLoadStoreOpt::RescheduleLoadStoreInstrs(MachineBasicBlock *MBB)
   bool RetVal = false;
 
   DenseMap<MachineInstr*, unsigned> MI2LocMap;
-  DenseMap<unsigned, SmallVector<MachineInstr*, 4> > Base2LdsMap;
-  DenseMap<unsigned, SmallVector<MachineInstr*, 4> > Base2StsMap;
-  SmallVector<unsigned, 4> LdBases;
-  SmallVector<unsigned, 4> StBases;
+  DenseMap<BaseIndex, SmallVector<MachineInstr*, 4> > Base2LdsMap;
+  DenseMap<BaseIndex, SmallVector<MachineInstr*, 4> > Base2StsMap;
+  SmallVector<BaseIndex, 4> LdBases;
+  SmallVector<BaseIndex, 4> StBases;
 
   unsigned Loc = 0;
   MachineBasicBlock::iterator MBBI = MBB->begin();
@@ -456,48 +573,28 @@ EpiphanyPreAllocLoadStoreOpt::RescheduleLoadStoreInstrs(MachineBasicBlock *MBB)
       if (!isMemoryOp(MI))
         continue;
 
-      int Opc = MI->getOpcode();
-      bool isLd = (Opc == Epiphany::LS32_LDR || Opc == Epiphany::LSFP32_LDR);
-      unsigned Base = MI->getOperand(1).getReg();
-      int Offset = getMemoryOpOffset(MI);
+      bool isLd = MI->mayLoad();
+      MemAddress Addr = getMemoryOpAddress(MI, MRI);
+      BaseIndex Key = getBaseKey(Addr);
+      DenseMap<BaseIndex, SmallVector<MachineInstr*, 4> > &Base2OpsMap =
+        isLd ? Base2LdsMap : Base2StsMap;
+      SmallVectorImpl<BaseIndex> &Bases = isLd ? LdBases : StBases;
 
       bool StopHere = false;
-      if (isLd) {
-        DenseMap<unsigned, SmallVector<MachineInstr*, 4> >::iterator BI =
-          Base2LdsMap.find(Base);
-        if (BI != Base2LdsMap.end()) {
-          for (unsigned i = 0, e = BI->second.size(); i != e; ++i) {
-            if (Offset == getMemoryOpOffset(BI->second[i])) {
-              StopHere = true;
-              break;
-            }
+      DenseMap<BaseIndex, SmallVector<MachineInstr*, 4> >::iterator BI =
+        Base2OpsMap.find(Key);
+      if (BI != Base2OpsMap.end()) {
+        for (unsigned i = 0, e = BI->second.size(); i != e; ++i) {
+          if (Addr.Offset == getMemoryOpAddress(BI->second[i], MRI).Offset) {
+            StopHere = true;
+            break;
           }
-          if (!StopHere)
-            BI->second.push_back(MI);
-        } else {
-          SmallVector<MachineInstr*, 4> MIs;
-          MIs.push_back(MI);
-          Base2LdsMap[Base] = MIs;
-          LdBases.push_back(Base);
         }
+        if (!StopHere)
+          BI->second.push_back(MI);
       } else {
-        DenseMap<unsigned, SmallVector<MachineInstr*, 4> >::iterator BI =
-          Base2StsMap.find(Base);
-        if (BI != Base2StsMap.end()) {
-          for (unsigned i = 0, e = BI->second.size(); i != e; ++i) {
-            if (Offset == getMemoryOpOffset(BI->second[i])) {
-              StopHere = true;
-              break;
-            }
-          }
-          if (!StopHere)
-            BI->second.push_back(MI);
-        } else {
-          SmallVector<MachineInstr*, 4> MIs;
-          MIs.push_back(MI);
-          Base2StsMap[Base] = MIs;
-          StBases.push_back(Base);
-        }
+        Base2OpsMap[Key].push_back(MI);
+        Bases.push_back(Key);
       }
 
       if (StopHere) {
@@ -510,18 +607,16 @@ EpiphanyPreAllocLoadStoreOpt::RescheduleLoadStoreInstrs(MachineBasicBlock *MBB)
 
     // Re-schedule loads.
     for (unsigned i = 0, e = LdBases.size(); i != e; ++i) {
-      unsigned Base = LdBases[i];
-      SmallVector<MachineInstr*, 4> &Lds = Base2LdsMap[Base];
+      SmallVector<MachineInstr*, 4> &Lds = Base2LdsMap[LdBases[i]];
       if (Lds.size() > 1)
-        RetVal |= RescheduleOps(MBB, Lds, Base, true, MI2LocMap);
+        RetVal |= RescheduleOps(MBB, Lds, true, MI2LocMap);
     }
 
     // Re-schedule stores.
     for (unsigned i = 0, e = StBases.size(); i != e; ++i) {
-      unsigned Base = StBases[i];
-      SmallVector<MachineInstr*, 4> &Sts = Base2StsMap[Base];
+      SmallVector<MachineInstr*, 4> &Sts = Base2StsMap[StBases[i]];
       if (Sts.size() > 1)
-        RetVal |= RescheduleOps(MBB, Sts, Base, false, MI2LocMap);
+        RetVal |= RescheduleOps(MBB, Sts, false, MI2LocMap);
     }
 
     if (MBBI != E) {
@@ -535,9 +630,187 @@ EpiphanyPreAllocLoadStoreOpt::RescheduleLoadStoreInstrs(MachineBasicBlock *MBB)
   return RetVal;
 }
 
+//===----------------------------------------------------------------------===//
+// After register allocation
+//===----------------------------------------------------------------------===//
+
+/// EpiphanyLoadStoreOpt - Post- register allocation pass that combines
+/// accesses to adjacent words whose registers already form an even / odd
+/// pair.
+
+namespace {
+  struct EpiphanyLoadStoreOpt : public MachineFunctionPass {
+    static char ID;
+    EpiphanyLoadStoreOpt() : MachineFunctionPass(ID) {}
+
+    const TargetInstrInfo *TII;
+    const TargetRegisterInfo *TRI;
+    AliasAnalysis *AA;
+
+    bool runOnMachineFunction(MachineFunction &Fn) override;
+
+    const char *getPassName() const override {
+      return "Epiphany load / store optimization pass";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<AAResultsWrapperPass>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+  private:
+    unsigned getPairReg(unsigned EvenReg, unsigned OddReg) const;
+    bool canMoveUpTo(MachineInstr *MI,
+                     SmallVectorImpl<MachineInstr*> &Between) const;
+    bool tryToPair(MachineBasicBlock &MBB, MachineBasicBlock::iterator &MBBI);
+  };
+  char EpiphanyLoadStoreOpt::ID = 0;
+}
+
+bool EpiphanyLoadStoreOpt::runOnMachineFunction(MachineFunction &Fn) {
+  TII = Fn.getSubtarget().getInstrInfo();
+  TRI = Fn.getSubtarget().getRegisterInfo();
+  AA  = &getAnalysis<AAResultsWrapperPass>().getAAResults();
 
-/// createEpiphanyLoadStoreOptimizationPass - returns an instance of the load / store
-/// optimization pass.
+  bool Modified = false;
+  for (MachineFunction::iterator MFI = Fn.begin(), E = Fn.end(); MFI != E;
+       ++MFI) {
+    MachineBasicBlock &MBB = *MFI;
+    for (MachineBasicBlock::iterator MBBI = MBB.begin(); MBBI != MBB.end();) {
+      if (isMemoryOp(MBBI) && !isRegOffsetOp(MBBI->getOpcode()) &&
+          tryToPair(MBB, MBBI)) {
+        Modified = true;
+        continue;
+      }
+      ++MBBI;
+    }
+  }
+  return Modified;
+}
+
+/// The doubleword register made of EvenReg and OddReg, or 0 if they aren't
+/// the two halves of one.
+unsigned EpiphanyLoadStoreOpt::getPairReg(unsigned EvenReg,
+                                          unsigned OddReg) const {
+  unsigned DReg = TRI->getMatchingSuperReg(EvenReg, Epiphany::sub_even,
+                                           &Epiphany::DPR64RegClass);
+  if (!DReg || TRI->getSubReg(DReg, Epiphany::sub_odd) != OddReg)
+    return 0;
+  return DReg;
+}
+
+/// Can MI be hoisted above every instruction in Between?
+bool
+EpiphanyLoadStoreOpt::canMoveUpTo(MachineInstr *MI,
+                                  SmallVectorImpl<MachineInstr*> &Between) const {
+  unsigned Reg = MI->getOperand(0).getReg();
+  unsigned Base = MI->getOperand(1).getReg();
+  bool isLd = MI->mayLoad();
+
+  for (unsigned i = 0, e = Between.size(); i != e; ++i) {
+    MachineInstr *I = Between[i];
+    if ((I->mayLoad() || I->mayStore()) && mayConflict(I, MI, AA))
+      return false;
+    for (unsigned j = 0, NumOps = I->getNumOperands(); j != NumOps; ++j) {
+      const MachineOperand &MO = I->getOperand(j);
+      if (!MO.isReg() || !MO.getReg())
+        continue;
+      if (MO.isDef() && TRI->regsOverlap(MO.getReg(), Base))
+        return false;
+      // A loaded register must not be touched in between at all, a stored
+      // one only not redefined.
+      if ((isLd || MO.isDef()) && TRI->regsOverlap(MO.getReg(), Reg))
+        return false;
+    }
+  }
+  return true;
+}
+
+/// Look a few instructions past MBBI for an access to the neighbouring word
+/// and merge the two at MBBI.
+bool EpiphanyLoadStoreOpt::tryToPair(MachineBasicBlock &MBB,
+                                     MachineBasicBlock::iterator &MBBI) {
+  MachineInstr *First = MBBI;
+  bool isLd = First->mayLoad();
+  MemAddress Addr = getMemoryOpAddress(First, nullptr);
+
+  // ldr r0, [r0]: anything after this sees a different base.
+  if (isLd && TRI->regsOverlap(First->getOperand(0).getReg(), Addr.Base))
+    return false;
+
+  SmallVector<MachineInstr*, 8> Between;
+  unsigned Count = 0;
+  for (MachineBasicBlock::iterator I = std::next(MBBI), E = MBB.end();
+       I != E && Count < MaxPairDistance; ++I) {
+    if (I->isDebugValue())
+      continue;
+    ++Count;
+    if (I->isCall() || I->isTerminator() || I->hasUnmodeledSideEffects())
+      return false;
+
+    MachineInstr *Second = I;
+    if (!isMemoryOp(Second) || isRegOffsetOp(Second->getOpcode()) ||
+        Second->mayLoad() != isLd ||
+        Second->getOperand(1).getReg() != Addr.Base) {
+      Between.push_back(Second);
+      continue;
+    }
+
+    MemAddress SecondAddr = getMemoryOpAddress(Second, nullptr);
+    MachineInstr *Op0 = First, *Op1 = Second;
+    if (SecondAddr.Offset + 4 == Addr.Offset)
+      std::swap(Op0, Op1);
+    else if (SecondAddr.Offset != Addr.Offset + 4) {
+      Between.push_back(Second);
+      continue;
+    }
+
+    int Offset = std::min(Addr.Offset, SecondAddr.Offset);
+    unsigned DReg = getPairReg(Op0->getOperand(0).getReg(),
+                               Op1->getOperand(0).getReg());
+    // The stack pointer is always 8-byte aligned, other bases only when the
+    // memory operand says so.
+    bool Aligned = Addr.Base == Epiphany::SP ||
+                   (*Op0->memoperands_begin())->getAlignment() >= 8;
+    if (!DReg || !Aligned || !isLegalPairOffset(Op0, Offset) ||
+        !canMoveUpTo(Second, Between)) {
+      Between.push_back(Second);
+      continue;
+    }
+
+    // Second's kills would now come too early, so the pair kills nothing.
+    const MCInstrDesc &MCID = TII->get(getPairedOpcode(Op0->getOpcode()));
+    MachineInstrBuilder MIB = BuildMI(MBB, MBBI, First->getDebugLoc(), MCID)
+      .addReg(DReg, getDefRegState(isLd))
+      .addReg(Addr.Base)
+      .addImm(Offset / 8);
+    concatenateMemOperands(MIB, Op0, Op1);
+    DEBUG(dbgs() << "Formed " << *MIB << "\n");
+    if (isLd)
+      ++NumLDRDPostRA;
+    else
+      ++NumSTRDPostRA;
+
+    First->eraseFromParent();
+    Second->eraseFromParent();
+    MBBI = MIB;
+    return true;
+  }
+  return false;
+}
+
+//===----------------------------------------------------------------------===//
+//                         Public Constructor Functions
+//===----------------------------------------------------------------------===//
+
+/// createEpiphanyLSOptPass - returns an instance of the pre- register
+/// allocation load / store pairing pass.
 FunctionPass *llvm::createEpiphanyLSOptPass() {
-    return new EpiphanyPreAllocLoadStoreOpt();
+  return new EpiphanyPreAllocLoadStoreOpt();
+}
+
+/// createEpiphanyPostRALSOptPass - returns an instance of the post- register
+/// allocation load / store pairing pass.
+FunctionPass *llvm::createEpiphanyPostRALSOptPass() {
+  return new EpiphanyLoadStoreOpt();
 }
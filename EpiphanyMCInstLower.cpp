@@ -34,7 +34,7 @@ EpiphanyAsmPrinter::lowerSymbolOperand(const MachineOperand &MO,
 
   Expr = MCSymbolRefExpr::create(Sym, MCSymbolRefExpr::VK_None, OutContext);
 
-  switch (MO.getTargetFlags()) {
+  switch (MO.getTargetFlags() & ~EpiphanyII::MO_HWLOOP_END) {
   case EpiphanyII::MO_LO16:
     Expr = EpiphanyMCExpr::CreateLo16(Expr, OutContext);
     break;
@@ -48,7 +48,7 @@ EpiphanyAsmPrinter::lowerSymbolOperand(const MachineOperand &MO,
     llvm_unreachable("Unexpected MachineOperand flag - lowersymboloperand");
   }
 
-  if (!MO.isJTI() && MO.getOffset())
+  if (!MO.isJTI() && !MO.isMBB() && MO.getOffset())
     Expr = MCBinaryExpr::createAdd(Expr,
                                    MCConstantExpr::create(MO.getOffset(),
                                                           OutContext),
@@ -87,8 +87,10 @@ bool EpiphanyAsmPrinter::lowerOperand(const MachineOperand &MO,
     MCOp = lowerSymbolOperand(MO, TM.getSymbol(MO.getGlobal(), *Mang));
     break;
   case MachineOperand::MO_MachineBasicBlock:
-    MCOp = MCOperand::createExpr(MCSymbolRefExpr::create(
-                                   MO.getMBB()->getSymbol(), OutContext));
+    if (MO.getTargetFlags() & EpiphanyII::MO_HWLOOP_END)
+      MCOp = lowerSymbolOperand(MO, GetHWLoopEndSymbol(MO.getMBB()));
+    else
+      MCOp = lowerSymbolOperand(MO, MO.getMBB()->getSymbol());
     break;
   case MachineOperand::MO_JumpTableIndex:
     MCOp = lowerSymbolOperand(MO, GetJTISymbol(MO.getIndex()));
@@ -0,0 +1,224 @@
+//===-- EpiphanyPostIncCombine.cpp - Form post-increment loads/stores -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass folds a pointer increment into a preceding load or store:
+//
+//   ldr r0, [r1, #0]            ldr r0, [r1], #1
+//   add r2, r1, #4        =>    (r2 is now the updated r1)
+//
+// The DAG combiner already does this within a selection DAG. This catches the
+// ones it can't see, e.g. when the access and the increment were in different
+// DAGs or the increment only became an ADDri after selection. It runs on SSA
+// form before register allocation so the tied base register costs nothing.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "epiphany-postinc"
+#include "Epiphany.h"
+#include "EpiphanyInstrInfo.h"
+#include "EpiphanySubtarget.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumPostInc, "Number of post-increment loads/stores formed");
+
+namespace {
+
+class EpiphanyPostIncCombine : public MachineFunctionPass {
+  const EpiphanyInstrInfo *TII;
+  MachineRegisterInfo *MRI;
+
+public:
+  static char ID;
+  EpiphanyPostIncCombine() : MachineFunctionPass(ID) {}
+
+  const char *getPassName() const override {
+    return "Epiphany post-increment load/store combine";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  bool combineBlock(MachineBasicBlock &MBB);
+  MachineInstr *findIncrement(MachineInstr *MI, unsigned Base, int MemSize,
+                              int64_t &Inc);
+};
+
+char EpiphanyPostIncCombine::ID = 0;
+
+} // end anonymous namespace
+
+/// Map an immediate-offset load/store to its post-increment form. Returns 0
+/// if MI isn't one.
+static unsigned getPostIncOpcode(unsigned Opc, int &MemSize, bool &IsLoad) {
+  IsLoad = true;
+  switch (Opc) {
+  case Epiphany::LS8_LDR:    MemSize = 1; return Epiphany::LS8_PostInd_LDR;
+  case Epiphany::LS16_LDR:   MemSize = 2; return Epiphany::LS16_PostInd_LDR;
+  case Epiphany::LS32_LDR:   MemSize = 4; return Epiphany::LS32_PostInd_LDR;
+  case Epiphany::LSFP32_LDR: MemSize = 4; return Epiphany::LSFP32_PostInd_LDR;
+  case Epiphany::LSFP64_LDR: MemSize = 8; return Epiphany::LSFP64_PostInd_LDR;
+  }
+
+  IsLoad = false;
+  switch (Opc) {
+  case Epiphany::LS8_STR:    MemSize = 1; return Epiphany::LS8_PostInd_STR;
+  case Epiphany::LS16_STR:   MemSize = 2; return Epiphany::LS16_PostInd_STR;
+  case Epiphany::LS32_STR:   MemSize = 4; return Epiphany::LS32_PostInd_STR;
+  case Epiphany::LSFP32_STR: MemSize = 4; return Epiphany::LSFP32_PostInd_STR;
+  case Epiphany::LSFP64_STR: MemSize = 8; return Epiphany::LSFP64_PostInd_STR;
+  default: return 0;
+  }
+}
+
+/// Look below MI for "ADDri/SUBri NewBase, Base, Imm" that can be folded into
+/// it. Base must not be read between the two, or anywhere after MI except by
+/// the increment, and nothing may read the flags the increment sets.
+MachineInstr *
+EpiphanyPostIncCombine::findIncrement(MachineInstr *MI, unsigned Base,
+                                      int MemSize, int64_t &Inc) {
+  MachineBasicBlock *MBB = MI->getParent();
+  MachineInstr *Incr = nullptr;
+  MachineBasicBlock::iterator I = MI, E = MBB->end();
+  for (++I; I != E; ++I) {
+    if ((I->getOpcode() == Epiphany::ADDri ||
+         I->getOpcode() == Epiphany::SUBri) &&
+        I->getOperand(1).isReg() && I->getOperand(1).getReg() == Base) {
+      Incr = I;
+      break;
+    }
+    if (I->readsRegister(Base))
+      return nullptr;
+  }
+  if (!Incr)
+    return nullptr;
+
+  unsigned NewBase = Incr->getOperand(0).getReg();
+  if (!TargetRegisterInfo::isVirtualRegister(NewBase) ||
+      MRI->getRegClass(NewBase) != &Epiphany::GPR32RegClass)
+    return nullptr;
+
+  // Only a plain immediate offset can be folded.
+  if (!Incr->getOperand(2).isImm())
+    return nullptr;
+  Inc = Incr->getOperand(2).getImm();
+  if (Incr->getOpcode() == Epiphany::SUBri)
+    Inc = -Inc;
+  if (Inc % MemSize != 0 || Inc / MemSize < -2047 || Inc / MemSize > 2047)
+    return nullptr;
+
+  // Every other use of Base has to come before MI.
+  for (MachineRegisterInfo::use_instr_nodbg_iterator
+         UI = MRI->use_instr_nodbg_begin(Base), UE = MRI->use_instr_nodbg_end();
+       UI != UE; ++UI) {
+    MachineInstr *UseMI = &*UI;
+    if (UseMI == MI || UseMI == Incr)
+      continue;
+    if (UseMI->getParent() != MBB)
+      return nullptr;
+    for (I = MI; I != E; ++I)
+      if (&*I == UseMI)
+        return nullptr;
+  }
+
+  // The increment sets NZCV, which a folded compare may be relying on.
+  for (I = Incr, ++I; I != E; ++I) {
+    if (I->readsRegister(Epiphany::NZCV))
+      return nullptr;
+    if (I->definesRegister(Epiphany::NZCV))
+      break;
+  }
+
+  return Incr;
+}
+
+bool EpiphanyPostIncCombine::combineBlock(MachineBasicBlock &MBB) {
+  bool Changed = false;
+
+  for (MachineBasicBlock::iterator MBBI = MBB.begin(), E = MBB.end();
+       MBBI != E;) {
+    MachineInstr *MI = MBBI++;
+
+    int MemSize = 0;
+    bool IsLoad;
+    unsigned NewOpc = getPostIncOpcode(MI->getOpcode(), MemSize, IsLoad);
+    if (!NewOpc)
+      continue;
+
+    // Both loads and stores are (Rt, Rn, Imm).
+    MachineOperand &BaseMO = MI->getOperand(1);
+    MachineOperand &OffMO = MI->getOperand(2);
+    if (!BaseMO.isReg() || !OffMO.isImm() || OffMO.getImm() != 0 ||
+        !TargetRegisterInfo::isVirtualRegister(BaseMO.getReg()))
+      continue;
+
+    unsigned Base = BaseMO.getReg();
+    int64_t Inc;
+    MachineInstr *Incr = findIncrement(MI, Base, MemSize, Inc);
+    if (!Incr)
+      continue;
+
+    unsigned NewBase = Incr->getOperand(0).getReg();
+    DEBUG(dbgs() << "Folding " << *Incr << "  into " << *MI);
+
+    MachineInstrBuilder MIB;
+    if (IsLoad)
+      MIB = BuildMI(MBB, MI, MI->getDebugLoc(), TII->get(NewOpc))
+              .addOperand(MI->getOperand(0))
+              .addReg(NewBase, RegState::Define);
+    else
+      MIB = BuildMI(MBB, MI, MI->getDebugLoc(), TII->get(NewOpc), NewBase)
+              .addOperand(MI->getOperand(0));
+    MIB.addReg(Base).addImm(Inc / MemSize);
+    MIB->setMemRefs(MI->memoperands_begin(), MI->memoperands_end());
+
+    // If the increment was what we'd have looked at next, move on past it.
+    if (MBBI == MachineBasicBlock::iterator(Incr))
+      ++MBBI;
+    MI->eraseFromParent();
+    Incr->eraseFromParent();
+    MRI->clearKillFlags(Base);
+
+    ++NumPostInc;
+    Changed = true;
+  }
+
+  return Changed;
+}
+
+bool EpiphanyPostIncCombine::runOnMachineFunction(MachineFunction &MF) {
+  TII = MF.getSubtarget<EpiphanySubtarget>().getInstrInfo();
+  MRI = &MF.getRegInfo();
+  assert(MRI->isSSA() && "post-increment combine expects SSA form");
+
+  bool Changed = false;
+  for (MachineFunction::iterator MBB = MF.begin(), E = MF.end(); MBB != E;
+       ++MBB)
+    Changed |= combineBlock(*MBB);
+  return Changed;
+}
+
+//===----------------------------------------------------------------------===//
+//                         Public Constructor Functions
+//===----------------------------------------------------------------------===//
+
+FunctionPass *llvm::createEpiphanyPostIncCombinePass() {
+  return new EpiphanyPostIncCombine();
+}
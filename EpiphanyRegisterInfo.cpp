@@ -14,6 +14,7 @@
 
 
 #include "EpiphanyRegisterInfo.h"
+#include "EpiphanyInstrInfo.h"
 #include "EpiphanyFrameLowering.h"
 #include "EpiphanyMachineFunctionInfo.h"
 #include "EpiphanyTargetMachine.h"
@@ -23,6 +24,7 @@
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/RegisterScavenging.h"
 #include "llvm/CodeGen/VirtRegMap.h" 
+#include "llvm/IR/Function.h"
 #include "llvm/ADT/BitVector.h"
 
 #define GET_REGINFO_TARGET_DESC
@@ -37,11 +39,16 @@ EpiphanyRegisterInfo::EpiphanyRegisterInfo(const EpiphanyInstrInfo &tii,
 
 const uint16_t *
 EpiphanyRegisterInfo::getCalleeSavedRegs(const MachineFunction *MF) const {
+  if (MF && MF->getFunction()->getCallingConv() == CallingConv::Fast)
+    return CSR_Fast_SaveList;
   return CSR_PCS_SaveList;
 }
 
 const uint32_t*
-EpiphanyRegisterInfo::getCallPreservedMask(CallingConv::ID) const {
+EpiphanyRegisterInfo::getCallPreservedMask(const MachineFunction &MF,
+                                           CallingConv::ID CC) const {
+  if (CC == CallingConv::Fast)
+    return CSR_Fast_RegMask;
   return CSR_PCS_RegMask;
 }
 
@@ -61,22 +68,53 @@ EpiphanyRegisterInfo::getReservedRegs(const MachineFunction &MF) const {
   const TargetFrameLowering *TFI = getFrameLowering(MF);
 
   Reserved.set(Epiphany::SP);
-  Reserved.set(Epiphany::R63);// hack: dst for cmp
-  //constants
-  Reserved.set(Epiphany::R28);
-  Reserved.set(Epiphany::R29);
-  Reserved.set(Epiphany::R30);
-  Reserved.set(Epiphany::R31);
-
   Reserved.set(Epiphany::NZCV);
+  Reserved.set(Epiphany::BFLAGS);
+
+  // Special registers, only touched through MOVTS/MOVFS.
+  for (MCPhysReg Reg : Epiphany::SCR32RegClass)
+    Reserved.set(Reg);
 
   if (TFI->hasFP(MF)) {
     Reserved.set(Epiphany::R11);
   }
 
+  // A register pair is unusable if either half is.
+  for (TargetRegisterClass::iterator I = Epiphany::DPR64RegClass.begin(),
+         E = Epiphany::DPR64RegClass.end(); I != E; ++I)
+    for (MCSubRegIterator SubReg(*I, this); SubReg.isValid(); ++SubReg)
+      if (Reserved.test(*SubReg))
+        Reserved.set(*I);
+
   return Reserved;
 }
 
+/// Steer values that are mostly used by instructions with a 16-bit encoding
+/// into r0-r7, so that EpiphanyCompress16 can shorten them after allocation.
+void
+EpiphanyRegisterInfo::getRegAllocationHints(unsigned VirtReg,
+                                            ArrayRef<MCPhysReg> Order,
+                                            SmallVectorImpl<MCPhysReg> &Hints,
+                                            const MachineFunction &MF,
+                                            const VirtRegMap *VRM) const {
+  TargetRegisterInfo::getRegAllocationHints(VirtReg, Order, Hints, MF, VRM);
+
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
+  unsigned NumOps = 0, NumShort = 0;
+  for (const MachineOperand &MO : MRI.reg_nodbg_operands(VirtReg)) {
+    ++NumOps;
+    if (TII.getCompressedOpcode(MO.getParent()->getOpcode()))
+      ++NumShort;
+  }
+  if (NumShort == 0 || 2 * NumShort < NumOps)
+    return;
+
+  for (MCPhysReg Reg : Order)
+    if (Epiphany::GPR16RegClass.contains(Reg) &&
+        std::find(Hints.begin(), Hints.end(), Reg) == Hints.end())
+      Hints.push_back(Reg);
+}
+
 void
 EpiphanyRegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator MBBI,
                                          int SPAdj,
@@ -94,14 +132,8 @@ EpiphanyRegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator MBBI,
   // callee-saved register, or whether it's a more generic
   // operation. Fortunately the frame indices are used *only* for that purpose
   // and are contiguous, so we can check here.
-  const std::vector<CalleeSavedInfo> &CSI = MFI->getCalleeSavedInfo();
-  int MinCSFI = 0;
-  int MaxCSFI = -1;
-
-  if (CSI.size()) {
-    MinCSFI = CSI[0].getFrameIdx();
-    MaxCSFI = CSI[CSI.size() - 1].getFrameIdx();
-  }
+  int MinCSFI, MaxCSFI;
+  TFI->getCalleeSavedFrameIndexRange(*MFI, MinCSFI, MaxCSFI);
 
   int FrameIndex = MI.getOperand(FIOperandNum).getIndex();
   bool IsCalleeSaveOp = FrameIndex >= MinCSFI && FrameIndex <= MaxCSFI;
@@ -9,10 +9,231 @@
 //
 // This file implements the EpiphanySelectionDAGInfo class.
 //
+// Copies and fills short enough for MaxStoresPerMemcpy / MaxStoresPerMemset
+// never get here: SelectionDAG unrolls them into word accesses itself. What
+// is left with a constant size and word alignment becomes a MEMCPY_LOOP or
+// MEMSET_LOOP pseudo, expanded into an ldrd/strd loop by the custom inserter.
+// Anything else is a library call.
+//
+// Large copies to or from the external DRAM or another core go through a DMA
+// channel instead, which streams far faster than the core's own loads and
+// stores over the mesh. The copy is a DMA_START followed by a separate DMA_WAIT, so
+// the scheduler is free to put independent work in between.
+//
 //===----------------------------------------------------------------------===//
 
-#define DEBUG_TYPE "arm-selectiondag-info"
+#define DEBUG_TYPE "epiphany-selectiondag-info"
 #include "EpiphanyTargetMachine.h"
+#include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/SelectionDAG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
 using namespace llvm;
 
+static cl::opt<bool>
+EnableDMAMemcpy("epiphany-dma-memcpy", cl::Hidden,
+                cl::desc("Use a DMA channel for large copies to or from "
+                         "external memory"),
+                cl::init(true));
+
+static cl::opt<unsigned>
+DMAMemcpyThreshold("epiphany-dma-memcpy-threshold", cl::Hidden,
+                   cl::desc("Minimum size in bytes of a copy done by DMA"),
+                   cl::init(256));
+
+static cl::opt<unsigned>
+DMAMemcpyChannel("epiphany-dma-memcpy-channel", cl::Hidden,
+                 cl::desc("DMA channel used for copies"), cl::init(1));
+
+// The host-shared DRAM window as seen from the cores.
+static const uint64_t ExternalMemBase = 0x8e000000;
+static const uint64_t ExternalMemSize = 0x02000000;
+
+/// Is a loop the right way to handle Size bytes at alignment Align? When
+/// optimizing for size the call to memcpy / memset is shorter.
+static bool shouldUseLoop(SelectionDAG &DAG, SDValue Size, unsigned Align) {
+  ConstantSDNode *ConstSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstSize || Align < 4)
+    return false;
+  if (DAG.getMachineFunction().getFunction()->optForSize())
+    return false;
+
+  // At least two trips round the loop, each covering two units.
+  unsigned Unit = Align >= 8 ? 8 : 4;
+  return ConstSize->getZExtValue() >= 4 * Unit &&
+         isUInt<32>(ConstSize->getZExtValue());
+}
+
+static SDValue getMemOpLoop(SelectionDAG &DAG, SDLoc dl, unsigned Opc,
+                            SDValue Chain, SDValue Dst, SDValue SrcOrVal,
+                            SDValue Size, unsigned Align) {
+  // The loop doesn't care about anything past ldrd/strd alignment.
+  Align = std::min(Align, 8u);
+  SDValue Ops[] = {
+    Chain, Dst, SrcOrVal,
+    DAG.getTargetConstant(cast<ConstantSDNode>(Size)->getZExtValue(), dl,
+                          MVT::i32),
+    DAG.getTargetConstant(Align, dl, MVT::i32)
+  };
+  return DAG.getNode(Opc, dl, MVT::Other, Ops);
+}
+
+/// Does Ptr provably point off-core? It does if it is in the external or
+/// remote-core address space, based on a global in the shared_dram section,
+/// or a constant address inside the external memory window.
+static bool isOffCore(SelectionDAG &DAG, SDValue Ptr,
+                      const MachinePointerInfo &PtrInfo) {
+  if (EpiphanyAS::isOffCore(PtrInfo.getAddrSpace()))
+    return true;
+
+  int64_t Offset = 0;
+  if (DAG.isBaseWithConstantOffset(Ptr)) {
+    Offset = cast<ConstantSDNode>(Ptr.getOperand(1))->getSExtValue();
+    Ptr = Ptr.getOperand(0);
+  }
+
+  if (GlobalAddressSDNode *GA = dyn_cast<GlobalAddressSDNode>(Ptr)) {
+    StringRef Section(GA->getGlobal()->getSection());
+    return Section == "shared_dram" || Section.startswith(".shared_dram");
+  }
+  if (ConstantSDNode *C = dyn_cast<ConstantSDNode>(Ptr)) {
+    uint64_t Addr = C->getZExtValue() + Offset;
+    return Addr >= ExternalMemBase && Addr < ExternalMemBase + ExternalMemSize;
+  }
+  return false;
+}
+
+/// Copy by DMA, moving the widest elements the alignment and size allow.
+/// The channel may still be busy with an earlier transfer, so wait for it
+/// before starting, then again for this copy to finish.
+static SDValue getDMACopy(SelectionDAG &DAG, SDLoc dl, SDValue Chain,
+                          SDValue Dst, SDValue Src, SDValue Size,
+                          unsigned Align, MachinePointerInfo DstPtrInfo,
+                          MachinePointerInfo SrcPtrInfo) {
+  ConstantSDNode *ConstSize = dyn_cast<ConstantSDNode>(Size);
+  if (!EnableDMAMemcpy || DMAMemcpyChannel > 1 || !ConstSize ||
+      ConstSize->getZExtValue() < DMAMemcpyThreshold)
+    return SDValue();
+  if (!isOffCore(DAG, Dst, DstPtrInfo) && !isOffCore(DAG, Src, SrcPtrInfo))
+    return SDValue();
+
+  uint64_t Bytes = ConstSize->getZExtValue();
+  unsigned Log2Unit = 3;
+  while ((1u << Log2Unit) > Align || Bytes % (1u << Log2Unit))
+    --Log2Unit;
+  uint64_t Count = Bytes >> Log2Unit;
+  if (!isUInt<16>(Count))
+    return SDValue();
+
+  unsigned Unit = 1u << Log2Unit;
+  // STRIDE: destination stride in the high half, source in the low.
+  // COUNT: outer count in the high half, inner count in the low.
+  // CONFIG: DMAEN and MASTER, with the element size in DATASIZE (bits 6-5).
+  uint32_t Stride = (Unit << 16) | Unit;
+  uint32_t CountReg = (1u << 16) | Count;
+  uint32_t Config = 0x3 | (Log2Unit << 5);
+
+  SDValue Chan = DAG.getTargetConstant(DMAMemcpyChannel, dl, MVT::i32);
+  Chain = DAG.getNode(EpiphanyISD::DMA_WAIT, dl, MVT::Other, Chain, Chan);
+  SDValue Ops[] = {
+    Chain, Dst, Src,
+    DAG.getConstant(Stride, dl, MVT::i32),
+    DAG.getConstant(CountReg, dl, MVT::i32),
+    DAG.getConstant(Config, dl, MVT::i32),
+    Chan
+  };
+  Chain = DAG.getNode(EpiphanyISD::DMA_START, dl, MVT::Other, Ops);
+  return DAG.getNode(EpiphanyISD::DMA_WAIT, dl, MVT::Other, Chain, Chan);
+}
+
+SDValue EpiphanySelectionDAGInfo::EmitTargetCodeForMemcpy(
+    SelectionDAG &DAG, SDLoc dl, SDValue Chain, SDValue Dst, SDValue Src,
+    SDValue Size, unsigned Align, bool isVolatile, bool AlwaysInline,
+    MachinePointerInfo DstPtrInfo, MachinePointerInfo SrcPtrInfo) const {
+  if (SDValue DMA = getDMACopy(DAG, dl, Chain, Dst, Src, Size, Align,
+                               DstPtrInfo, SrcPtrInfo))
+    return DMA;
+  if (!shouldUseLoop(DAG, Size, Align))
+    return SDValue();
+  return getMemOpLoop(DAG, dl, EpiphanyISD::MEMCPY, Chain, Dst, Src, Size,
+                      Align);
+}
+
+/// Split Ptr into a stack object or global and a constant offset from it.
+static bool getBaseObject(SelectionDAG &DAG, SDValue Ptr, const void *&Base,
+                          int64_t &Offset) {
+  Offset = 0;
+  if (DAG.isBaseWithConstantOffset(Ptr)) {
+    Offset = cast<ConstantSDNode>(Ptr.getOperand(1))->getSExtValue();
+    Ptr = Ptr.getOperand(0);
+  }
+
+  // FrameIndex nodes are CSEd, so the node identifies the object.
+  if (FrameIndexSDNode *FI = dyn_cast<FrameIndexSDNode>(Ptr)) {
+    Base = FI;
+    return true;
+  }
+  // Only a global that is its own object. An alias may point into another
+  // global, so two different aliases or an alias and its aliasee can overlap.
+  if (GlobalAddressSDNode *GA = dyn_cast<GlobalAddressSDNode>(Ptr)) {
+    const GlobalValue *GV = GA->getGlobal();
+    if (!isa<GlobalVariable>(GV) && !isa<Function>(GV))
+      return false;
+    Base = GV;
+    Offset += GA->getOffset();
+    return true;
+  }
+  return false;
+}
+
+SDValue EpiphanySelectionDAGInfo::EmitTargetCodeForMemmove(
+    SelectionDAG &DAG, SDLoc dl, SDValue Chain, SDValue Dst, SDValue Src,
+    SDValue Size, unsigned Align, bool isVolatile,
+    MachinePointerInfo DstPtrInfo, MachinePointerInfo SrcPtrInfo) const {
+  if (!shouldUseLoop(DAG, Size, Align))
+    return SDValue();
+
+  // The loop copies forwards, so it is only a memmove if the two ranges are
+  // provably disjoint: different objects, or far enough apart in one.
+  const void *DstBase, *SrcBase;
+  int64_t DstOffset, SrcOffset;
+  if (!getBaseObject(DAG, Dst, DstBase, DstOffset) ||
+      !getBaseObject(DAG, Src, SrcBase, SrcOffset))
+    return SDValue();
+
+  int64_t Bytes = cast<ConstantSDNode>(Size)->getZExtValue();
+  if (DstBase == SrcBase && DstOffset + Bytes > SrcOffset &&
+      SrcOffset + Bytes > DstOffset)
+    return SDValue();
+
+  return getMemOpLoop(DAG, dl, EpiphanyISD::MEMCPY, Chain, Dst, Src, Size,
+                      Align);
+}
+
+SDValue EpiphanySelectionDAGInfo::EmitTargetCodeForMemset(
+    SelectionDAG &DAG, SDLoc dl, SDValue Chain, SDValue Dst, SDValue Val,
+    SDValue Size, unsigned Align, bool isVolatile,
+    MachinePointerInfo DstPtrInfo) const {
+  if (!shouldUseLoop(DAG, Size, Align))
+    return SDValue();
+
+  // Spread the byte across a word; the inserter pairs it up for strd.
+  SDValue Word;
+  if (ConstantSDNode *C = dyn_cast<ConstantSDNode>(Val)) {
+    Word = DAG.getConstant((C->getZExtValue() & 0xff) * 0x01010101U, dl,
+                           MVT::i32);
+  } else {
+    Word = DAG.getZExtOrTrunc(Val, dl, MVT::i32);
+    Word = DAG.getNode(ISD::OR, dl, MVT::i32, Word,
+                       DAG.getNode(ISD::SHL, dl, MVT::i32, Word,
+                                   DAG.getConstant(8, dl, MVT::i32)));
+    Word = DAG.getNode(ISD::OR, dl, MVT::i32, Word,
+                       DAG.getNode(ISD::SHL, dl, MVT::i32, Word,
+                                   DAG.getConstant(16, dl, MVT::i32)));
+  }
+
+  return getMemOpLoop(DAG, dl, EpiphanyISD::MEMSET, Chain, Dst, Word, Size,
+                      Align);
+}
@@ -26,18 +26,26 @@
 
 using namespace llvm;
 
+/// Without -mcpu, schedule for the generic core rather than for no machine
+/// model at all.
+static StringRef selectEpiphanyCPU(StringRef CPU) {
+  return CPU.empty() ? "generic" : CPU;
+}
+
 EpiphanySubtarget &
 EpiphanySubtarget::initializeSubtargetDependencies(StringRef CPU, StringRef FS)
 {
     ParseSubtargetFeatures(CPU, FS);
+    InstrItins = getInstrItineraryForCPU(CPU);
     return *this;
 }
 
 EpiphanySubtarget::EpiphanySubtarget(const Triple &TT, StringRef CPU, StringRef FS, const TargetMachine &TM)
-  : EpiphanyGenSubtargetInfo(TT, CPU, FS)
+  : EpiphanyGenSubtargetInfo(TT, selectEpiphanyCPU(CPU), FS)
   , TargetTriple(TT)
+  , HasIMul(false)
   , FrameLowering()
-  , InstrInfo(initializeSubtargetDependencies(CPU, FS))
+  , InstrInfo(initializeSubtargetDependencies(selectEpiphanyCPU(CPU), FS))
   , TLInfo(TM, *this)
 {}
 
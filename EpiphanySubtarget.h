@@ -19,6 +19,7 @@
 #include "EpiphanyInstrInfo.h"
 #include "EpiphanyISelLowering.h"
 #include "EpiphanyFrameLowering.h"
+#include "EpiphanySelectionDAGInfo.h"
 
 #define GET_SUBTARGETINFO_HEADER
 #include "EpiphanyGenSubtargetInfo.inc"
@@ -33,9 +34,18 @@ class EpiphanySubtarget : public EpiphanyGenSubtargetInfo {
 protected:
   /// TargetTriple - What processor and OS we're targeting.
   Triple TargetTriple;
+
+  /// HasIMul - True if the assembler accepts IMUL/IMADD/IMSUB. Code
+  /// generation never uses them, as they need CONFIG in integer mode.
+  bool HasIMul;
+
+  /// InstrItins - Instruction itineraries of the selected core.
+  InstrItineraryData InstrItins;
+
   EpiphanyFrameLowering FrameLowering;
   EpiphanyInstrInfo InstrInfo;
   EpiphanyTargetLowering TLInfo;
+  EpiphanySelectionDAGInfo TSInfo;
 private:
   EpiphanySubtarget &initializeSubtargetDependencies(StringRef CPU, StringRef FS);
 
@@ -51,6 +61,16 @@ public:
 
   bool GVIsIndirectSymbol(const GlobalValue *GV, Reloc::Model RelocM) const;
 
+  bool hasIMul() const { return HasIMul; }
+
+  const InstrItineraryData *getInstrItineraryData() const override {
+    return &InstrItins;
+  }
+
+  /// The cores are in-order and dual issue, so the order of the IALU and
+  /// FPU streams matters; use the MachineScheduler rather than the DAG order.
+  bool enableMachineScheduler() const override { return true; }
+
   bool isTargetELF() const { return TargetTriple.isOSBinFormatELF(); }
   bool isTargetLinux() const { return TargetTriple.getOS() == Triple::Linux; }
 
@@ -68,6 +88,10 @@ public:
     return &TLInfo;
   }
 
+  const EpiphanySelectionDAGInfo *getSelectionDAGInfo() const override {
+    return &TSInfo;
+  }
+
 
 };
 } // End llvm namespace
@@ -16,8 +16,11 @@
 #include "Epiphany.h"
 #include "EpiphanyTargetMachine.h"
 #include "EpiphanyTargetObjectFile.h"
+#include "EpiphanyTargetTransformInfo.h"
 #include "MCTargetDesc/EpiphanyMCTargetDesc.h"
+#include "Utils/EpiphanyBaseInfo.h"
 #include "llvm/PassManager.h"
+#include "llvm/CodeGen/MachineScheduler.h"
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/CommandLine.h"
@@ -26,17 +29,43 @@ using namespace llvm;
 
 static cl::opt<bool>
 EnableLSD("double-ls", cl::Hidden,
-                  cl::desc("Enable double loads and stores"),
-                  cl::init(false));
+                  cl::desc("Pair adjacent word loads and stores into ldrd/strd"),
+                  cl::init(true));
 
+static cl::opt<bool>
+EnableHWLoops("epiphany-hwloops", cl::Hidden,
+                  cl::desc("Use the zero-overhead loop hardware for counted inner loops"),
+                  cl::init(true));
+
+static cl::opt<bool>
+EnablePostInc("epiphany-postinc", cl::Hidden,
+                  cl::desc("Fold pointer increments into post-increment loads and stores"),
+                  cl::init(true));
+
+static cl::opt<bool>
+EnableCompress16("epiphany-compress16", cl::Hidden,
+                  cl::desc("Use 16-bit encodings where the operands allow"),
+                  cl::init(true));
+
+static cl::opt<bool>
+EnableBranchRelax("epiphany-short-branches", cl::Hidden,
+                  cl::desc("Use 16-bit branches where the target is in range"),
+                  cl::init(true));
+
+static cl::opt<bool>
+EnableGlobalMerge("epiphany-global-merge", cl::Hidden,
+                  cl::desc("Merge small globals so they share one base address"),
+                  cl::init(true));
 
 extern "C" void LLVMInitializeEpiphanyTarget() {
   RegisterTargetMachine<EpiphanyTargetMachine> X(TheEpiphanyTarget);
 }
 
+// Address spaces 1-3 are external, remote-core and local memory (see
+// EpiphanyAS). All of them are 32-bit addresses into the one global map.
 static std::string computeDataLayout()
 {
-    return "e-p:32:32-i8:8:8-i16:16:16-i32:32:32-f32:32:32-i64:64:64-f64:64:64-s64:64:64-S64:64:64-a0:32:32";
+    return "e-p:32:32-p1:32:32-p2:32:32-p3:32:32-i8:8:8-i16:16:16-i32:32:32-f32:32:32-i64:64:64-f64:64:64-s64:64:64-S64:64:64-a0:32:32";
 }
 
 EpiphanyTargetMachine::EpiphanyTargetMachine(const Target &T, const Triple &TT,
@@ -47,8 +76,16 @@ EpiphanyTargetMachine::EpiphanyTargetMachine(const Target &T, const Triple &TT,
   : LLVMTargetMachine(T, computeDataLayout(), TT, CPU, FS, Options, RM, CM, OL),
     Subtarget(TT, CPU, FS, *this),
     InstrInfo(Subtarget),
-    DL("e-p:32:32-i8:8:8-i16:16:16-i32:32:32-f32:32:32-i64:64:64-f64:64:64-s64:64:64-S64:64:64-a0:32:32"),
+    DL(computeDataLayout()),
     TLOF(make_unique<EpiphanyLinuxTargetObjectFile>()) {
+      // Without an FPU divide or square root, estimates are always worth it
+      // once unsafe-fp-math allows them. Each Newton-Raphson step roughly
+      // doubles the correct bits of the bit-trick estimates in
+      // EpiphanyISelLowering, about 4 for 1/x and 5 for 1/sqrt(x), so both
+      // need three steps to reach full single precision; two would leave
+      // 1/sqrt(x) at about 17 bits.
+      this->Options.Reciprocals.setDefaults("divf", true, 3);
+      this->Options.Reciprocals.setDefaults("sqrtf", true, 3);
       initAsmInfo();
 }
 
@@ -57,6 +94,61 @@ void EpiphanyTargetMachine::resetSubtarget(MachineFunction *MF)
     MF->setSubtarget(&Subtarget);
 }
 
+TargetIRAnalysis EpiphanyTargetMachine::getTargetIRAnalysis() {
+  return TargetIRAnalysis([this](const Function &F) {
+    return TargetTransformInfo(EpiphanyTTIImpl(this, F));
+  });
+}
+
+namespace {
+/// Stores to another core or to external memory are posted: the core hands
+/// them to the mesh and carries on. Issued back to back in address order they
+/// stream through the network; anything in between leaves gaps. Link each
+/// off-core store to the next one off the same base with a cluster edge, so
+/// the scheduler keeps them together.
+class OffCoreStoreClusterMutation : public ScheduleDAGMutation {
+public:
+  void apply(ScheduleDAGMI *DAG) override;
+};
+} // namespace
+
+void OffCoreStoreClusterMutation::apply(ScheduleDAGMI *DAG) {
+  struct StoreInfo {
+    unsigned Base;
+    int64_t Offset;
+    SUnit *SU;
+  };
+  SmallVector<StoreInfo, 8> Stores;
+
+  for (SUnit &SU : DAG->SUnits) {
+    const MachineInstr *MI = SU.getInstr();
+    // Only [Rn, #disp] stores: value, base, scaled displacement.
+    if (!MI->mayStore() || MI->mayLoad() || !MI->hasOneMemOperand() ||
+        MI->getNumExplicitOperands() != 3 || MI->getOperand(0).isDef() ||
+        !MI->getOperand(1).isReg() || !MI->getOperand(2).isImm())
+      continue;
+    if (!EpiphanyAS::isOffCore(EpiphanyInstrInfo::getAccessAddrSpace(*MI)))
+      continue;
+
+    uint64_t Size = (*MI->memoperands_begin())->getSize();
+    StoreInfo Info = { MI->getOperand(1).getReg(),
+                       MI->getOperand(2).getImm() * int64_t(Size), &SU };
+    Stores.push_back(Info);
+  }
+  if (Stores.size() < 2)
+    return;
+
+  std::sort(Stores.begin(), Stores.end(),
+            [](const StoreInfo &LHS, const StoreInfo &RHS) {
+              if (LHS.Base != RHS.Base)
+                return LHS.Base < RHS.Base;
+              return LHS.Offset < RHS.Offset;
+            });
+  for (unsigned i = 0, e = Stores.size() - 1; i != e; ++i)
+    if (Stores[i].Base == Stores[i + 1].Base)
+      DAG->addEdge(Stores[i + 1].SU, SDep(Stores[i].SU, SDep::Cluster));
+}
+
 namespace {
 /// Epiphany Code Generator Pass Configuration Options.
 class EpiphanyPassConfig : public TargetPassConfig {
@@ -69,10 +161,20 @@ public:
   }
 
 
+  ScheduleDAGInstrs *
+  createMachineScheduler(MachineSchedContext *C) const override {
+    ScheduleDAGMILive *DAG = createGenericSchedLive(C);
+    DAG->addMutation(make_unique<OffCoreStoreClusterMutation>());
+    return DAG;
+  }
+
+  bool addPreISel() override;
   bool addInstSelector() override;
+  bool addILPOpts() override;
   void addPreEmitPass() override;
   void addPreRegAlloc() override;
   void addPostRegAlloc() override;
+  void addPreSched2() override;
 };
 } // namespace
 
@@ -81,19 +183,54 @@ TargetPassConfig *EpiphanyTargetMachine::createPassConfig(PassManagerBase &PM) {
 }
 
 void EpiphanyPassConfig::addPreEmitPass() {
+  if (EnableCompress16 && getOptLevel() != CodeGenOpt::None)
+    addPass(createEpiphanyCompress16Pass());
+  if (EnableHWLoops && getOptLevel() != CodeGenOpt::None)
+    addPass(createEpiphanyHardwareLoopFixupPass());
+  if (EnableBranchRelax && getOptLevel() != CodeGenOpt::None)
+    addPass(createEpiphanyBranchRelaxationPass());
   addPass(&UnpackMachineBundlesID);
 }
 
+bool EpiphanyPassConfig::addPreISel() {
+  // Every global costs a mov/movt pair to address. Laying the small ones out
+  // together lets one base reach them all through the load/store
+  // displacement, which is 2047 bytes for ldrb and more for wider accesses.
+  if (EnableGlobalMerge && getOptLevel() != CodeGenOpt::None)
+    addPass(createGlobalMergePass(TM, 2047));
+
+  // Needed for correctness, so it runs at -O0 too.
+  addPass(createEpiphanyConfigUpdateSplitPass(getEpiphanyTargetMachine()));
+  return false;
+}
+
 bool EpiphanyPassConfig::addInstSelector() {
   addPass(createEpiphanyISelDAG(getEpiphanyTargetMachine(), getOptLevel()));
     return false;
 }
 
+bool EpiphanyPassConfig::addILPOpts() {
+  // Forms fmadd/fmsub and reassociates FP chains; it checks
+  // EpiphanyInstrInfo::useMachineCombiner itself.
+  addPass(&MachineCombinerID);
+  return true;
+}
+
 void EpiphanyPassConfig::addPreRegAlloc() {
-	if (EnableLSD)
+	if (EnableLSD && getOptLevel() != CodeGenOpt::None)
 		addPass(createEpiphanyLSOptPass());
+	if (EnableHWLoops && getOptLevel() != CodeGenOpt::None)
+		addPass(createEpiphanyHardwareLoopsPass());
+	if (EnablePostInc && getOptLevel() != CodeGenOpt::None)
+		addPass(createEpiphanyPostIncCombinePass());
 }
 
 void EpiphanyPassConfig::addPostRegAlloc() {
   addPass(createEpiphanyCondMovPass(getEpiphanyTargetMachine()));
 }
+
+void EpiphanyPassConfig::addPreSched2() {
+  // Frame offsets are final here, so spills and reloads can be paired too.
+  if (EnableLSD && getOptLevel() != CodeGenOpt::None)
+    addPass(createEpiphanyPostRALSOptPass());
+}
@@ -17,6 +17,7 @@
 #include "EpiphanyFrameLowering.h"
 #include "EpiphanyISelLowering.h"
 #include "EpiphanyInstrInfo.h"
+#include "EpiphanyIntrinsicInfo.h"
 #include "EpiphanySelectionDAGInfo.h"
 #include "EpiphanySubtarget.h"
 #include "llvm/IR/DataLayout.h"
@@ -27,6 +28,7 @@ namespace llvm {
 class EpiphanyTargetMachine : public LLVMTargetMachine {
   EpiphanySubtarget          Subtarget;
   EpiphanyInstrInfo          InstrInfo;
+  EpiphanyIntrinsicInfo      IntrinsicInfo;
   const DataLayout          DL;
   std::unique_ptr<TargetLoweringObjectFile> TLOF;
 
@@ -42,6 +44,10 @@ public:
 
   void resetSubtarget(MachineFunction *MF);
 
+  const EpiphanyIntrinsicInfo *getIntrinsicInfo() const override {
+    return &IntrinsicInfo;
+  }
+
   TargetLoweringObjectFile* getObjFileLowering() const override {
     return TLOF.get();
   }
@@ -54,6 +60,8 @@ public:
     return &InstrInfo.getRegisterInfo();
   }
   TargetPassConfig *createPassConfig(PassManagerBase &PM);
+
+  TargetIRAnalysis getTargetIRAnalysis() override;
 };
 
 }
@@ -22,3 +22,10 @@ EpiphanyLinuxTargetObjectFile::Initialize(MCContext &Ctx,
   TargetLoweringObjectFileELF::Initialize(Ctx, TM);
   InitializeELF(TM.Options.UseInitArray);
 }
+
+bool EpiphanyLinuxTargetObjectFile::shouldPutJumpTableInFunctionSection(
+    bool UsesLabelDifference, const Function &F) const {
+  // A function linked into a core's SRAM should not fetch its dispatch table
+  // over the mesh. Wherever the code goes, the table goes with it.
+  return true;
+}
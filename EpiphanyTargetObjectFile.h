@@ -24,6 +24,11 @@ namespace llvm {
   /// Epiphany.
   class EpiphanyLinuxTargetObjectFile : public TargetLoweringObjectFileELF {
     virtual void Initialize(MCContext &Ctx, const TargetMachine &TM);
+
+    /// Keep jump tables next to the code that uses them, so they end up in
+    /// the same local memory bank rather than in external .rodata.
+    bool shouldPutJumpTableInFunctionSection(bool UsesLabelDifference,
+                                             const Function &F) const override;
   };
 
 } // end namespace llvm
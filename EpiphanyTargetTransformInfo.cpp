@@ -0,0 +1,153 @@
+//===-- EpiphanyTargetTransformInfo.cpp - Epiphany specific TTI -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "EpiphanyTargetTransformInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "epiphanytti"
+
+int EpiphanyTTIImpl::getIntImmCost(const APInt &Imm, Type *Ty) {
+  assert(Ty->isIntegerTy());
+
+  unsigned BitSize = Ty->getPrimitiveSizeInBits();
+  if (BitSize == 0)
+    return ~0U;
+
+  // Wider constants are built one 32-bit word at a time.
+  APInt ImmVal = Imm;
+  if (BitSize & 0x1f)
+    ImmVal = Imm.sext((BitSize + 31) & ~0x1fU);
+
+  int Cost = 0;
+  for (unsigned ShiftVal = 0; ShiftVal < BitSize; ShiftVal += 32) {
+    uint64_t Word = ImmVal.ashr(ShiftVal).getLoBits(32).getZExtValue();
+    Cost += isUInt<16>(Word) ? 1 : 2;
+  }
+  return Cost;
+}
+
+int EpiphanyTTIImpl::getIntImmCost(unsigned Opcode, unsigned Idx,
+                                   const APInt &Imm, Type *Ty) {
+  assert(Ty->isIntegerTy());
+
+  unsigned BitSize = Ty->getPrimitiveSizeInBits();
+  if (BitSize == 0 || BitSize > 32)
+    return getIntImmCost(Imm, Ty);
+
+  int64_t Val = Imm.getSExtValue();
+  switch (Opcode) {
+  default:
+    break;
+  case Instruction::GetElementPtr:
+    // Always hoist the base address of a GetElementPtr; the indices end up as
+    // load/store offsets or adds.
+    if (Idx == 0)
+      return 2 * TTI::TCC_Basic;
+    return TTI::TCC_Free;
+  case Instruction::Add:
+  case Instruction::Sub:
+    if (Idx == 1 && TLI->isLegalAddImmediate(Opcode == Instruction::Sub ? -Val
+                                                                        : Val))
+      return TTI::TCC_Free;
+    break;
+  case Instruction::ICmp:
+    if (Idx == 1 && TLI->isLegalICmpImmediate(Val))
+      return TTI::TCC_Free;
+    break;
+  case Instruction::Shl:
+  case Instruction::LShr:
+  case Instruction::AShr:
+    // Shift amounts are encoded in the instruction.
+    if (Idx == 1)
+      return TTI::TCC_Free;
+    break;
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+  case Instruction::SExt:
+  case Instruction::IntToPtr:
+  case Instruction::PtrToInt:
+  case Instruction::BitCast:
+  case Instruction::PHI:
+  case Instruction::Call:
+  case Instruction::Select:
+  case Instruction::Ret:
+  case Instruction::Load:
+    return TTI::TCC_Free;
+  }
+  return getIntImmCost(Imm, Ty);
+}
+
+int EpiphanyTTIImpl::getIntImmCost(Intrinsic::ID IID, unsigned Idx,
+                                   const APInt &Imm, Type *Ty) {
+  assert(Ty->isIntegerTy());
+
+  // Some intrinsic operands have to stay immediates (alignments, volatile
+  // flags), so never hoist out of an intrinsic call.
+  return TTI::TCC_Free;
+}
+
+int EpiphanyTTIImpl::getArithmeticInstrCost(
+    unsigned Opcode, Type *Ty, TTI::OperandValueKind Opd1Info,
+    TTI::OperandValueKind Opd2Info, TTI::OperandValueProperties Opd1PropInfo,
+    TTI::OperandValueProperties Opd2PropInfo) {
+  std::pair<int, MVT> LT = TLI->getTypeLegalizationCost(DL, Ty);
+  int ISD = TLI->InstructionOpcodeToISD(Opcode);
+
+  switch (ISD) {
+  default:
+    break;
+  case ISD::SDIV:
+  case ISD::UDIV:
+  case ISD::SREM:
+  case ISD::UREM:
+    // Powers of two become shifts and masks; anything else is __divsi3 and
+    // friends.
+    if (Opd2Info == TTI::OK_UniformConstantValue &&
+        Opd2PropInfo == TTI::OP_PowerOf2)
+      return LT.first * 3 * TTI::TCC_Basic;
+    return LT.first * 40 * TTI::TCC_Basic;
+  case ISD::MUL:
+    return LT.first * 30 * TTI::TCC_Basic;
+  case ISD::FDIV:
+    // A reciprocal estimate and Newton-Raphson at best, a libcall at worst.
+    return LT.first * 20 * TTI::TCC_Basic;
+  case ISD::FREM:
+    return LT.first * 40 * TTI::TCC_Basic;
+  }
+
+  return BaseT::getArithmeticInstrCost(Opcode, Ty, Opd1Info, Opd2Info,
+                                       Opd1PropInfo, Opd2PropInfo);
+}
+
+void EpiphanyTTIImpl::getUnrollingPreferences(Loop *L,
+                                              TTI::UnrollingPreferences &UP) {
+  // A call in the body clobbers the registers unrolling wants to use, and
+  // the call itself dwarfs the loop overhead.
+  for (Loop::block_iterator I = L->block_begin(), E = L->block_end(); I != E;
+       ++I)
+    for (BasicBlock::iterator J = (*I)->begin(), JE = (*I)->end(); J != JE;
+         ++J)
+      if ((isa<CallInst>(J) || isa<InvokeInst>(J)) && !isa<IntrinsicInst>(J))
+        return;
+
+  UP.Threshold = 100;
+  UP.PartialThreshold = 100;
+  UP.OptSizeThreshold = 0;
+  UP.PartialOptSizeThreshold = 0;
+  UP.Partial = true;
+  UP.Runtime = true;
+  // Counted loops run on the hardware loop registers without any branch
+  // overhead, so there is little to gain past a factor of four.
+  UP.MaxCount = 4;
+}
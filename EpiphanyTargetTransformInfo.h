@@ -0,0 +1,92 @@
+//===-- EpiphanyTargetTransformInfo.h - Epiphany specific TTI ---*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file provides a TargetTransformInfo::Concept conforming object specific
+// to the Epiphany target machine. It uses the target's detailed information to
+// provide more precise answers to certain TTI queries, while letting the
+// target independent and default TTI implementations handle the rest.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EPIPHANYTARGETTRANSFORMINFO_H
+#define LLVM_EPIPHANYTARGETTRANSFORMINFO_H
+
+#include "Epiphany.h"
+#include "EpiphanyTargetMachine.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/CodeGen/BasicTTIImpl.h"
+
+namespace llvm {
+
+class EpiphanyTTIImpl : public BasicTTIImplBase<EpiphanyTTIImpl> {
+  typedef BasicTTIImplBase<EpiphanyTTIImpl> BaseT;
+  typedef TargetTransformInfo TTI;
+  friend BaseT;
+
+  const EpiphanySubtarget *ST;
+  const EpiphanyTargetLowering *TLI;
+
+  const EpiphanySubtarget *getST() const { return ST; }
+  const EpiphanyTargetLowering *getTLI() const { return TLI; }
+
+public:
+  explicit EpiphanyTTIImpl(const EpiphanyTargetMachine *TM, const Function &F)
+    : BaseT(TM, F.getParent()->getDataLayout()), ST(TM->getSubtargetImpl(F)),
+      TLI(ST->getTargetLowering()) {}
+
+  // Provide value semantics. MSVC requires that we spell all of these out.
+  EpiphanyTTIImpl(const EpiphanyTTIImpl &Arg)
+    : BaseT(static_cast<const BaseT &>(Arg)), ST(Arg.ST), TLI(Arg.TLI) {}
+  EpiphanyTTIImpl(EpiphanyTTIImpl &&Arg)
+    : BaseT(std::move(static_cast<BaseT &>(Arg))), ST(std::move(Arg.ST)),
+      TLI(std::move(Arg.TLI)) {}
+
+  /// \name Scalar TTI Implementations
+  /// @{
+
+  /// A 16-bit unsigned constant is one mov, anything else a mov/movt pair.
+  int getIntImmCost(const APInt &Imm, Type *Ty);
+  /// Immediates that fold into the user are free, so ConstantHoisting leaves
+  /// them alone.
+  int getIntImmCost(unsigned Opcode, unsigned Idx, const APInt &Imm, Type *Ty);
+  int getIntImmCost(Intrinsic::ID IID, unsigned Idx, const APInt &Imm,
+                    Type *Ty);
+
+  /// @}
+
+  /// \name Vector TTI Implementations
+  /// @{
+
+  /// No SIMD, but 64 general registers to interleave into.
+  unsigned getNumberOfRegisters(bool Vector) { return Vector ? 0 : 61; }
+  unsigned getRegisterBitWidth(bool Vector) { return Vector ? 0 : 32; }
+
+  /// The IALU and FPU issue in parallel, so two independent iterations keep
+  /// both busy.
+  unsigned getMaxInterleaveFactor(unsigned VF) { return 2; }
+
+  /// There is no divider and, on some parts, no multiplier; both end up as
+  /// libcalls costing tens of cycles.
+  int getArithmeticInstrCost(
+      unsigned Opcode, Type *Ty,
+      TTI::OperandValueKind Opd1Info = TTI::OK_AnyValue,
+      TTI::OperandValueKind Opd2Info = TTI::OK_AnyValue,
+      TTI::OperandValueProperties Opd1PropInfo = TTI::OP_None,
+      TTI::OperandValueProperties Opd2PropInfo = TTI::OP_None);
+
+  /// @}
+
+  /// Code and data share 32KB of local memory, so unroll modestly and not at
+  /// all when optimising for size.
+  void getUnrollingPreferences(Loop *L, TTI::UnrollingPreferences &UP);
+};
+
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,163 @@
+//===-- EpiphanyAsmBackend.cpp - Epiphany Assembler Backend ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the Epiphany assembler backend: resolving fixups into
+// instruction fields and creating the ELF object writer.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/EpiphanyFixupKinds.h"
+#include "MCTargetDesc/EpiphanyMCTargetDesc.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/MC/MCAsmBackend.h"
+#include "llvm/MC/MCELFObjectWriter.h"
+#include "llvm/MC/MCFixupKindInfo.h"
+#include "llvm/MC/MCObjectWriter.h"
+#include "llvm/Support/ELF.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/// Turn a resolved fixup value into the bits to OR into the instruction.
+static uint64_t adjustFixupValue(unsigned Kind, uint64_t Value) {
+  switch (Kind) {
+  default:
+    llvm_unreachable("Unknown fixup kind!");
+  case FK_Data_1:
+  case FK_Data_2:
+  case FK_Data_4:
+    return Value;
+  case Epiphany::fixup_epiphany_simm24: {
+    int64_t Offset = static_cast<int64_t>(Value);
+    if (Offset & 1)
+      report_fatal_error("branch target not halfword aligned");
+    if (!isInt<25>(Offset))
+      report_fatal_error("branch target out of range");
+    return ((Offset >> 1) & 0xffffff) << 8;
+  }
+  case Epiphany::fixup_epiphany_simm8: {
+    int64_t Offset = static_cast<int64_t>(Value);
+    if (Offset & 1)
+      report_fatal_error("branch target not halfword aligned");
+    if (!isInt<9>(Offset))
+      report_fatal_error("branch target out of range");
+    return ((Offset >> 1) & 0xff) << 8;
+  }
+  case Epiphany::fixup_epiphany_high:
+    Value >>= 16;
+    // Fall through
+  case Epiphany::fixup_epiphany_low:
+    return ((Value & 0xff) << 5) | (((Value >> 8) & 0xff) << 20);
+  }
+}
+
+/// Number of bytes of the instruction or data a fixup touches.
+static unsigned getFixupNumBytes(unsigned Kind) {
+  switch (Kind) {
+  default:
+    llvm_unreachable("Unknown fixup kind!");
+  case FK_Data_1:
+    return 1;
+  case FK_Data_2:
+  case Epiphany::fixup_epiphany_simm8:
+    return 2;
+  case FK_Data_4:
+  case Epiphany::fixup_epiphany_simm24:
+  case Epiphany::fixup_epiphany_high:
+  case Epiphany::fixup_epiphany_low:
+    return 4;
+  }
+}
+
+namespace {
+
+class EpiphanyAsmBackend : public MCAsmBackend {
+  uint8_t OSABI;
+
+public:
+  EpiphanyAsmBackend(const Target &T, uint8_t OSABI)
+    : MCAsmBackend(), OSABI(OSABI) {}
+
+  unsigned getNumFixupKinds() const override {
+    return Epiphany::NumTargetFixupKinds;
+  }
+
+  const MCFixupKindInfo &getFixupKindInfo(MCFixupKind Kind) const override {
+    const static MCFixupKindInfo Infos[Epiphany::NumTargetFixupKinds] = {
+      // This table *must* be in the order that the fixup_* kinds are defined
+      // in EpiphanyFixupKinds.h.
+      //
+      // Name                      Offset (bits) Size (bits)     Flags
+      { "fixup_epiphany_simm24",   8,            24,  MCFixupKindInfo::FKF_IsPCRel },
+      { "fixup_epiphany_simm8",    8,             8,  MCFixupKindInfo::FKF_IsPCRel },
+      { "fixup_epiphany_high",     0,            32,  0 },
+      { "fixup_epiphany_low",      0,            32,  0 }
+    };
+
+    if (Kind < FirstTargetFixupKind)
+      return MCAsmBackend::getFixupKindInfo(Kind);
+
+    assert(unsigned(Kind - FirstTargetFixupKind) < getNumFixupKinds() &&
+           "Invalid kind!");
+    return Infos[Kind - FirstTargetFixupKind];
+  }
+
+  void applyFixup(const MCFixup &Fixup, char *Data, unsigned DataSize,
+                  uint64_t Value, bool IsPCRel) const override {
+    unsigned Kind = Fixup.getKind();
+    Value = adjustFixupValue(Kind, Value);
+    if (!Value)
+      return; // Doesn't change encoding.
+
+    unsigned Offset = Fixup.getOffset();
+    unsigned NumBytes = getFixupNumBytes(Kind);
+    assert(Offset + NumBytes <= DataSize && "Invalid fixup offset!");
+
+    // Instructions and data are little-endian.
+    for (unsigned i = 0; i != NumBytes; ++i)
+      Data[Offset + i] |= uint8_t((Value >> (i * 8)) & 0xff);
+  }
+
+  bool mayNeedRelaxation(const MCInst &Inst) const override { return false; }
+
+  bool fixupNeedsRelaxation(const MCFixup &Fixup, uint64_t Value,
+                            const MCRelaxableFragment *DF,
+                            const MCAsmLayout &Layout) const override {
+    return false;
+  }
+
+  void relaxInstruction(const MCInst &Inst, MCInst &Res) const override {
+    llvm_unreachable("EpiphanyAsmBackend::relaxInstruction() unimplemented");
+  }
+
+  /// Padding is made of 16-bit nops, so it has to be an even length.
+  bool writeNopData(uint64_t Count, MCObjectWriter *OW) const override {
+    if (Count % 2)
+      return false;
+
+    for (uint64_t i = 0; i != Count; i += 2)
+      OW->write16(0x01a2);
+    return true;
+  }
+
+  MCObjectWriter *createObjectWriter(raw_pwrite_stream &OS) const override {
+    return createEpiphanyELFObjectWriter(OS, OSABI);
+  }
+};
+
+} // end anonymous namespace
+
+MCAsmBackend *llvm::createEpiphanyAsmBackend(const Target &T,
+                                             const MCRegisterInfo &MRI,
+                                             const Triple &TT, StringRef CPU) {
+  uint8_t OSABI = MCELFObjectTargetWriter::getOSABI(TT.getOS());
+  return new EpiphanyAsmBackend(T, OSABI);
+}
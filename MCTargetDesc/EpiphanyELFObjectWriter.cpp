@@ -0,0 +1,109 @@
+//===-- EpiphanyELFObjectWriter.cpp - Epiphany ELF Writer -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file maps Epiphany fixups onto the ELF relocations understood by the
+// GNU tools (see binutils include/elf/epiphany.h).
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/EpiphanyFixupKinds.h"
+#include "MCTargetDesc/EpiphanyMCTargetDesc.h"
+#include "llvm/MC/MCELFObjectWriter.h"
+#include "llvm/MC/MCExpr.h"
+#include "llvm/MC/MCValue.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace llvm;
+
+namespace {
+
+// Not in Support/ELF.h yet.
+enum {
+  EM_ADAPTEVA_EPIPHANY = 0x1223
+};
+
+enum {
+  R_EPIPHANY_NONE = 0,
+  R_EPIPHANY_8 = 1,
+  R_EPIPHANY_16 = 2,
+  R_EPIPHANY_32 = 3,
+  R_EPIPHANY_8_PCREL = 4,
+  R_EPIPHANY_16_PCREL = 5,
+  R_EPIPHANY_32_PCREL = 6,
+  R_EPIPHANY_SIMM8 = 7,
+  R_EPIPHANY_SIMM24 = 8,
+  R_EPIPHANY_HIGH = 9,
+  R_EPIPHANY_LOW = 10,
+  R_EPIPHANY_SIMM11 = 11,
+  R_EPIPHANY_IMM11 = 12,
+  R_EPIPHANY_IMM8 = 13
+};
+
+class EpiphanyELFObjectWriter : public MCELFObjectTargetWriter {
+public:
+  EpiphanyELFObjectWriter(uint8_t OSABI);
+
+  ~EpiphanyELFObjectWriter() override;
+
+protected:
+  unsigned GetRelocType(const MCValue &Target, const MCFixup &Fixup,
+                        bool IsPCRel) const override;
+};
+
+} // end anonymous namespace
+
+EpiphanyELFObjectWriter::EpiphanyELFObjectWriter(uint8_t OSABI)
+  : MCELFObjectTargetWriter(/*Is64Bit*/ false, OSABI, EM_ADAPTEVA_EPIPHANY,
+                            /*HasRelocationAddend*/ true) {}
+
+EpiphanyELFObjectWriter::~EpiphanyELFObjectWriter() {}
+
+unsigned EpiphanyELFObjectWriter::GetRelocType(const MCValue &Target,
+                                               const MCFixup &Fixup,
+                                               bool IsPCRel) const {
+  unsigned Kind = Fixup.getKind();
+
+  if (IsPCRel) {
+    switch (Kind) {
+    default:
+      llvm_unreachable("Unsupported pc-relative fixup kind");
+    case FK_Data_1:
+      return R_EPIPHANY_8_PCREL;
+    case FK_Data_2:
+      return R_EPIPHANY_16_PCREL;
+    case FK_Data_4:
+      return R_EPIPHANY_32_PCREL;
+    case Epiphany::fixup_epiphany_simm8:
+      return R_EPIPHANY_SIMM8;
+    case Epiphany::fixup_epiphany_simm24:
+      return R_EPIPHANY_SIMM24;
+    }
+  }
+
+  switch (Kind) {
+  default:
+    llvm_unreachable("Unsupported fixup kind");
+  case FK_Data_1:
+    return R_EPIPHANY_8;
+  case FK_Data_2:
+    return R_EPIPHANY_16;
+  case FK_Data_4:
+    return R_EPIPHANY_32;
+  case Epiphany::fixup_epiphany_high:
+    return R_EPIPHANY_HIGH;
+  case Epiphany::fixup_epiphany_low:
+    return R_EPIPHANY_LOW;
+  }
+}
+
+MCObjectWriter *llvm::createEpiphanyELFObjectWriter(raw_pwrite_stream &OS,
+                                                    uint8_t OSABI) {
+  MCELFObjectTargetWriter *MOTW = new EpiphanyELFObjectWriter(OSABI);
+  return createELFObjectWriter(MOTW, OS, /*IsLittleEndian*/ true);
+}
@@ -0,0 +1,43 @@
+//=- EpiphanyFixupKinds.h - Epiphany Specific Fixup Entries -----*- C++ -*-=//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file describes the Epiphany specific fixups, one per relocatable
+// instruction field.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EPIPHANY_EPIPHANYFIXUPKINDS_H
+#define LLVM_EPIPHANY_EPIPHANYFIXUPKINDS_H
+
+#include "llvm/MC/MCFixup.h"
+
+namespace llvm {
+namespace Epiphany {
+
+enum Fixups {
+  // 24-bit PC-relative halfword offset in bits 31:8 of a 32-bit branch.
+  fixup_epiphany_simm24 = FirstTargetFixupKind,
+
+  // 8-bit PC-relative halfword offset in bits 15:8 of a 16-bit branch.
+  fixup_epiphany_simm8,
+
+  // The top and bottom halves of an address, for movt and mov. The 16 bits
+  // are split between bits 12:5 and 27:20 of the instruction.
+  fixup_epiphany_high,
+  fixup_epiphany_low,
+
+  // Marker
+  LastTargetFixupKind,
+  NumTargetFixupKinds = LastTargetFixupKind - FirstTargetFixupKind
+};
+
+} // end namespace Epiphany
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,197 @@
+//=- EpiphanyMCCodeEmitter.cpp - Convert Epiphany code to machine code -----=//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the EpiphanyMCCodeEmitter class. The field layouts
+// come from the Enc* classes in EpiphanyInstrFormats.td; this only supplies
+// operand values and records fixups for anything that isn't known yet.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "mccodeemitter"
+#include "MCTargetDesc/EpiphanyFixupKinds.h"
+#include "MCTargetDesc/EpiphanyMCExpr.h"
+#include "MCTargetDesc/EpiphanyMCTargetDesc.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/MC/MCCodeEmitter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(MCNumEmitted, "Number of MC instructions emitted");
+
+namespace {
+
+class EpiphanyMCCodeEmitter : public MCCodeEmitter {
+  EpiphanyMCCodeEmitter(const EpiphanyMCCodeEmitter &) = delete;
+  void operator=(const EpiphanyMCCodeEmitter &) = delete;
+  const MCInstrInfo &MCII;
+  const MCRegisterInfo &MRI;
+
+public:
+  EpiphanyMCCodeEmitter(const MCInstrInfo &mcii, const MCRegisterInfo &mri)
+    : MCII(mcii), MRI(mri) {}
+
+  ~EpiphanyMCCodeEmitter() override {}
+
+  // getBinaryCodeForInstr - TableGen'erated function for getting the
+  // binary encoding for an instruction.
+  uint64_t getBinaryCodeForInstr(const MCInst &MI,
+                                 SmallVectorImpl<MCFixup> &Fixups,
+                                 const MCSubtargetInfo &STI) const;
+
+  /// getMachineOpValue - Return binary encoding of operand. If the machine
+  /// operand requires relocation, record the relocation and return zero.
+  unsigned getMachineOpValue(const MCInst &MI, const MCOperand &MO,
+                             SmallVectorImpl<MCFixup> &Fixups,
+                             const MCSubtargetInfo &STI) const;
+
+  /// Branch targets are halfword offsets from the branch itself.
+  unsigned getBranchTargetOpValue(const MCInst &MI, unsigned OpIdx,
+                                  SmallVectorImpl<MCFixup> &Fixups,
+                                  const MCSubtargetInfo &STI) const;
+
+  /// Load/store displacements are sign and magnitude: bit 11 set means the
+  /// (already scaled) offset is subtracted from the base.
+  unsigned getLdStDispOpValue(const MCInst &MI, unsigned OpIdx,
+                              SmallVectorImpl<MCFixup> &Fixups,
+                              const MCSubtargetInfo &STI) const;
+
+  /// The top half of a movt operand. Integer operands are already shifted
+  /// down; FP ones are the whole float.
+  unsigned getMovtImmOpValue(const MCInst &MI, unsigned OpIdx,
+                             SmallVectorImpl<MCFixup> &Fixups,
+                             const MCSubtargetInfo &STI) const;
+
+  void encodeInstruction(const MCInst &MI, raw_ostream &OS,
+                         SmallVectorImpl<MCFixup> &Fixups,
+                         const MCSubtargetInfo &STI) const override;
+
+private:
+  unsigned getExprOpValue(const MCInst &MI, const MCExpr *Expr,
+                          SmallVectorImpl<MCFixup> &Fixups) const;
+};
+
+} // end anonymous namespace
+
+/// Record a fixup for a %low()/%high() operand.
+unsigned
+EpiphanyMCCodeEmitter::getExprOpValue(const MCInst &MI, const MCExpr *Expr,
+                                      SmallVectorImpl<MCFixup> &Fixups) const {
+  const EpiphanyMCExpr *EExpr = dyn_cast<EpiphanyMCExpr>(Expr);
+  if (!EExpr)
+    llvm_unreachable("unexpected expression operand");
+
+  MCFixupKind Kind;
+  switch (EExpr->getKind()) {
+  default: llvm_unreachable("unexpected expression kind");
+  case EpiphanyMCExpr::VK_EPIPHANY_LO16:
+    Kind = MCFixupKind(Epiphany::fixup_epiphany_low);
+    break;
+  case EpiphanyMCExpr::VK_EPIPHANY_HI16:
+    Kind = MCFixupKind(Epiphany::fixup_epiphany_high);
+    break;
+  }
+
+  Fixups.push_back(MCFixup::create(0, EExpr, Kind, MI.getLoc()));
+  return 0;
+}
+
+unsigned
+EpiphanyMCCodeEmitter::getMachineOpValue(const MCInst &MI, const MCOperand &MO,
+                                         SmallVectorImpl<MCFixup> &Fixups,
+                                         const MCSubtargetInfo &STI) const {
+  if (MO.isReg())
+    return MRI.getEncodingValue(MO.getReg());
+  if (MO.isImm())
+    return static_cast<unsigned>(MO.getImm());
+  if (MO.isFPImm())
+    return FloatToBits(static_cast<float>(MO.getFPImm()));
+
+  assert(MO.isExpr() && "unknown operand kind in getMachineOpValue");
+  return getExprOpValue(MI, MO.getExpr(), Fixups);
+}
+
+unsigned
+EpiphanyMCCodeEmitter::getBranchTargetOpValue(const MCInst &MI, unsigned OpIdx,
+                                              SmallVectorImpl<MCFixup> &Fixups,
+                                              const MCSubtargetInfo &STI) const {
+  const MCOperand &MO = MI.getOperand(OpIdx);
+  if (MO.isImm())
+    return static_cast<unsigned>(MO.getImm());
+
+  assert(MO.isExpr() && "unexpected branch target");
+  MCFixupKind Kind = MCII.get(MI.getOpcode()).getSize() == 2
+                       ? MCFixupKind(Epiphany::fixup_epiphany_simm8)
+                       : MCFixupKind(Epiphany::fixup_epiphany_simm24);
+  Fixups.push_back(MCFixup::create(0, MO.getExpr(), Kind, MI.getLoc()));
+  return 0;
+}
+
+unsigned
+EpiphanyMCCodeEmitter::getLdStDispOpValue(const MCInst &MI, unsigned OpIdx,
+                                          SmallVectorImpl<MCFixup> &Fixups,
+                                          const MCSubtargetInfo &STI) const {
+  int64_t Off = MI.getOperand(OpIdx).getImm();
+  assert(Off >= -2047 && Off <= 2047 && "load/store offset out of range");
+  if (Off < 0)
+    return (1 << 11) | static_cast<unsigned>(-Off);
+  return static_cast<unsigned>(Off);
+}
+
+unsigned
+EpiphanyMCCodeEmitter::getMovtImmOpValue(const MCInst &MI, unsigned OpIdx,
+                                         SmallVectorImpl<MCFixup> &Fixups,
+                                         const MCSubtargetInfo &STI) const {
+  const MCOperand &MO = MI.getOperand(OpIdx);
+  if (MO.isExpr())
+    return getExprOpValue(MI, MO.getExpr(), Fixups);
+  if (MO.isFPImm())
+    return FloatToBits(static_cast<float>(MO.getFPImm())) >> 16;
+
+  int64_t Imm = MO.getImm();
+  assert(isUInt<16>(Imm) && "movt operand is the shifted top half");
+  return static_cast<unsigned>(Imm);
+}
+
+void EpiphanyMCCodeEmitter::encodeInstruction(const MCInst &MI, raw_ostream &OS,
+                                              SmallVectorImpl<MCFixup> &Fixups,
+                                              const MCSubtargetInfo &STI) const {
+  const MCInstrDesc &Desc = MCII.get(MI.getOpcode());
+  uint64_t Bits = getBinaryCodeForInstr(MI, Fixups, STI);
+
+  // Instructions are little-endian; the 16-bit forms are a single halfword.
+  support::endian::Writer<support::little> W(OS);
+  switch (Desc.getSize()) {
+  default: llvm_unreachable("unexpected instruction size");
+  case 2:
+    W.write<uint16_t>(static_cast<uint16_t>(Bits));
+    break;
+  case 4:
+    W.write<uint32_t>(static_cast<uint32_t>(Bits));
+    break;
+  }
+
+  ++MCNumEmitted; // Keep track of the # of mi's emitted.
+}
+
+MCCodeEmitter *llvm::createEpiphanyMCCodeEmitter(const MCInstrInfo &MCII,
+                                                 const MCRegisterInfo &MRI,
+                                                 MCContext &Ctx) {
+  return new EpiphanyMCCodeEmitter(MCII, MRI);
+}
+
+#include "EpiphanyGenMCCodeEmitter.inc"
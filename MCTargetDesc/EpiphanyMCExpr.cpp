@@ -53,7 +53,7 @@ void EpiphanyMCExpr::visitUsedExpr(MCStreamer &Streamer) const {
 }
 
 MCSection *EpiphanyMCExpr::findAssociatedSection() const {
-    llvm_unreachable("TODO: add code");
+  return getSubExpr()->findAssociatedSection();
 }
 
 bool
@@ -12,7 +12,6 @@
 //===----------------------------------------------------------------------===//
 
 #include "EpiphanyMCTargetDesc.h"
-//#include "EpiphanyELFStreamer.h"
 #include "EpiphanyMCAsmInfo.h"
 #include "InstPrinter/EpiphanyInstPrinter.h"
 #include "llvm/ADT/APInt.h"
@@ -154,17 +153,13 @@ extern "C" void LLVMInitializeEpiphanyTargetMC() {
   TargetRegistry::RegisterMCInstrAnalysis(TheEpiphanyTarget,
                                           createEpiphanyMCInstrAnalysis);
 
-  //// Register the MC Code Emitter
-  //TargetRegistry::RegisterMCCodeEmitter(TheEpiphanyTarget,
-  //                                      createEpiphanyMCCodeEmitter);
+  // Register the MC Code Emitter
+  TargetRegistry::RegisterMCCodeEmitter(TheEpiphanyTarget,
+                                        createEpiphanyMCCodeEmitter);
 
-  //// Register the asm backend.
-  //TargetRegistry::RegisterMCAsmBackend(TheEpiphanyTarget,
-  //                                     createEpiphanyAsmBackend);
-
-  //// Register the object streamer.
-  //TargetRegistry::RegisterMCObjectStreamer(TheEpiphanyTarget,
-  //                                         createMCStreamer);
+  // Register the asm backend. Objects go through the default ELF streamer.
+  TargetRegistry::RegisterMCAsmBackend(TheEpiphanyTarget,
+                                       createEpiphanyAsmBackend);
 
   // Register the MCInstPrinter.
   TargetRegistry::RegisterMCInstPrinter(TheEpiphanyTarget,
@@ -28,6 +28,7 @@ class StringRef;
 class Target;
 class Triple;
 class raw_ostream;
+class raw_pwrite_stream;
 
 extern Target TheEpiphanyTarget;
 
@@ -36,16 +37,16 @@ namespace Epiphany_MC {
                                                 StringRef FS);
 }
 
-//MCCodeEmitter *createEpiphanyMCCodeEmitter(const MCInstrInfo &MCII,
-//                                          const MCRegisterInfo &MRI,
-//                                          const MCSubtargetInfo &STI,
-//                                          MCContext &Ctx);
+MCCodeEmitter *createEpiphanyMCCodeEmitter(const MCInstrInfo &MCII,
+                                           const MCRegisterInfo &MRI,
+                                           MCContext &Ctx);
 
-//MCObjectWriter *createEpiphanyELFObjectWriter(raw_ostream &OS,
-//                                             uint8_t OSABI);
+MCObjectWriter *createEpiphanyELFObjectWriter(raw_pwrite_stream &OS,
+                                             uint8_t OSABI);
 
-//MCAsmBackend *createEpiphanyAsmBackend(const Target &T, StringRef TT,
-//                                      StringRef CPU);
+MCAsmBackend *createEpiphanyAsmBackend(const Target &T,
+                                       const MCRegisterInfo &MRI,
+                                       const Triple &TT, StringRef CPU);
 
 } // End llvm namespace
 
@@ -81,8 +81,36 @@ namespace EpiphanyII {
 
 		// LO/HI reloc, only for symbols
 		MO_LO16,
-		MO_HI16
+		MO_HI16,
+
+		// On a basic block operand: refer to the last instruction of the
+		// hardware loop in that block (LE) instead of the block itself (LS).
+		// Combined with MO_LO16/MO_HI16.
+		MO_HWLOOP_END = 0x4
+	};
+}
+
+namespace EpiphanyAS {
+
+	enum AddressSpaces {
+		// Unqualified pointers, which may point anywhere.
+		Generic = 0,
+
+		// The off-chip DRAM shared by all cores and the host.
+		External = 1,
+
+		// Another core's SRAM, reached over the eMesh. Writes are posted,
+		// reads are a round trip.
+		Remote = 2,
+
+		// This core's own SRAM.
+		Local = 3
 	};
+
+	/// Accesses that leave the core and travel over the mesh.
+	inline bool isOffCore(unsigned AS) {
+		return AS == External || AS == Remote;
+	}
 }
 
 class APFloat;